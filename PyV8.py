@@ -35,8 +35,8 @@ import _PyV8
 __author__ = 'Flier Lu <flier.lu@gmail.com>'
 __version__ = '1.0'
 
-__all__ = ["ReadOnly", "DontEnum", "DontDelete", "Internal",
-           "JSError", "JSObject", "JSNull", "JSUndefined", "JSArray", "JSFunction",
+__all__ = ["ReadOnly", "DontEnum", "DontDelete", "Internal", "JSTemplate", "JSKeywords", "JSSignature",
+           "JSError", "JSObject", "JSNull", "JSUndefined", "JSArray", "JSArrayBuffer", "JSTypedArray", "JSFunction",
            "JSClass", "JSEngine", "JSContext", "JSIsolate",
            "JSObjectSpace", "JSAllocationAction",
            "JSStackTrace", "JSStackFrame", "profiler",
@@ -55,6 +55,28 @@ ReadOnly = JSAttribute(name='readonly')
 DontEnum = JSAttribute(name='dontenum')
 DontDelete = JSAttribute(name='dontdel')
 Internal = JSAttribute(name='internal')
+JSTemplate = JSAttribute(name='jstemplate')
+JSKeywords = JSAttribute(name='jskeywords')
+
+
+class JSSignature(object):
+    """Declare the types of arguments and result for a Python function called from Javascript,
+    which could be 'object', 'int32', 'uint32', 'double', 'bool', 'str' or 'bytes'."""
+
+    TYPES = ('object', 'int32', 'uint32', 'double', 'bool', 'str', 'bytes')
+
+    def __init__(self, *argtypes, **kwds):
+        self.argtypes = argtypes
+        self.restype = kwds.get('returns', 'object')
+
+        for spec in argtypes + (self.restype,):
+            if spec not in self.TYPES:
+                raise TypeError("unknown signature type: %s" % spec)
+
+    def __call__(self, func):
+        func.__jssignature__ = (self.argtypes, self.restype)
+
+        return func
 
 
 class JSError(Exception):
@@ -144,6 +166,8 @@ _PyV8._JSError._jsclass = JSError
 
 JSObject = _PyV8.JSObject
 JSFunction = _PyV8.JSFunction
+JSArrayBuffer = _PyV8.JSArrayBuffer
+JSTypedArray = _PyV8.JSTypedArray
 
 # contribute by e.generalov
 
@@ -801,15 +825,11 @@ class JSContext(_PyV8.JSContext):
 
 # contribute by marc boeker <http://code.google.com/u/marc.boeker/>
 def convert(obj):
-    if type(obj) == _PyV8.JSArray or type(obj) == JSArray:
-        return [convert(v) for v in obj]
-
     if type(obj) == _PyV8.JSFunction:
         return "[function Function]"
 
-    if type(obj) == _PyV8.JSObject:
-        return dict([[str(k), convert(obj.__getattr__(str(k)))]
-                     for k in (obj.__dir__() if is_py3k else obj.__members__)])
+    if type(obj) in (_PyV8.JSArray, JSArray, _PyV8.JSObject):
+        return obj.toPython()
 
     return obj
 
@@ -924,6 +944,40 @@ class TestContext(unittest.TestCase):
         self.assertTrue(not bool(default.entered))
         self.assertTrue(not bool(default.inContext))
 
+    def testLivingObjects(self):
+        class Global(JSClass):
+            o = object()
+
+        with JSContext(Global()) as ctxt:
+            count = ctxt.livingObjects
+
+            self.assertTrue(count > 0)
+            self.assertTrue(ctxt.livingMemory > 0)
+
+            ctxt.eval("var x = o; var y = o;")
+
+            self.assertEqual(count + 1, ctxt.livingObjects)
+
+    def testLivingPool(self):
+        class Global(JSClass):
+            items = [object() for i in range(1000)]
+
+        with JSIsolate() as isolate:
+            with JSContext(Global()) as ctxt:
+                memory = ctxt.livingMemory
+
+                ctxt.eval("var objs = []; for (var i=0; i<items.length; i++) objs.push(items[i]);")
+
+                self.assertTrue(ctxt.livingObjects >= 1000)
+                self.assertTrue(ctxt.livingMemory > memory)
+
+                ctxt.eval("objs = null;")
+
+                isolate.collect()
+
+                self.assertTrue(ctxt.livingObjects < 1000)
+                self.assertTrue(ctxt.eval("items[0]") is Global.items[0])
+
     def _testMultiContext(self):
         # Create an environment
         with JSContext() as ctxt0:
@@ -1023,8 +1077,326 @@ class TestWrapper(unittest.TestCase):
             self.assertEqual(hash(o1), hash(o))
             self.assertTrue(o != o1)
 
+            o = ctxt.eval(u"({ 'name': 1, 'caf\xe9': 2, '\u540d\u5b57': 3, '\U0001f603': 4 })")
+
+            self.assertEqual(1, o['name'])
+            self.assertEqual(2, o[u'caf\xe9' if is_py3k else u'caf\xe9'.encode('utf-8')])
+            self.assertEqual(3, o[u'\u540d\u5b57' if is_py3k else u'\u540d\u5b57'.encode('utf-8')])
+            self.assertEqual(4, o[u'\U0001f603' if is_py3k else u'\U0001f603'.encode('utf-8')])
+
         self.assertRaises(UnboundLocalError, o.clone)
 
+    def testPropertyName(self):
+        _intern = getattr(sys, 'intern', None) or intern
+
+        with JSIsolate():
+            with JSContext() as ctxt:
+                o = ctxt.eval("({ 'foo': 1, 'bar': 2 })")
+
+                for i in range(100):
+                    self.assertEqual(1, o.foo)
+
+                o.baz = 3
+
+                self.assertEqual(3, o['baz'])
+                self.assertEqual(3, o['ba' + 'z'.lower()])
+                self.assertTrue('bar' in o)
+                self.assertFalse('qux' in o)
+
+                del o.bar
+
+                self.assertFalse('bar' in o)
+                self.assertRaises(TypeError, o.__getitem__, 1)
+
+                names = [_intern('name%d' % i) for i in range(1500)]
+
+                for i, name in enumerate(names):
+                    o[name] = i
+
+                for i, name in enumerate(names):
+                    self.assertEqual(i, o[name])
+
+                self.assertEqual(1499, ctxt.eval("(function (o) { return o.name1499; })")(o))
+
+    def testSingleLookup(self):
+        with JSContext() as ctxt:
+            o = ctxt.eval("""({
+                gets: 0, sets: 0, nothing: undefined,
+                get value() { this.gets++; return 42; },
+                set value(v) { this.sets++; }
+            })""")
+
+            self.assertEqual(42, o.value)
+            self.assertEqual(1, o.gets)
+
+            o.value = 1
+
+            self.assertEqual(1, o.gets)
+            self.assertEqual(1, o.sets)
+
+            self.assertEqual(None, o.nothing)
+            self.assertRaises(AttributeError, getattr, o, 'missing')
+
+            ctxt.eval("Object.prototype.inherited = undefined")
+
+            self.assertEqual(None, o.inherited)
+
+            ctxt.eval("delete Object.prototype.inherited")
+
+    def testBulkAccess(self):
+        with JSContext() as ctxt:
+            o = ctxt.eval("({ 'a': 1, 'b': 'x', 'c': [1, 2] })")
+
+            self.assertEqual(['a', 'b', 'c'], list(o.keys()))
+            self.assertEqual([1, 'x'], o.values()[:2])
+            self.assertEqual([('a', 1), ('b', 'x')], o.items()[:2])
+
+            d = o.to_dict()
+
+            self.assertEqual(['a', 'b', 'c'], sorted(d.keys()))
+            self.assertEqual(2, d['c'][1])
+
+            o.update({'d': 4, 'a': 0})
+            o.update([('e', 5)])
+            o.update({1: 'one'}.items())
+
+            self.assertEqual(0, o.a)
+            self.assertEqual(4, o.d)
+            self.assertEqual(5, o.e)
+            self.assertEqual('one', ctxt.eval("(function (o) { return o[1]; })")(o))
+
+            self.assertRaises(ValueError, o.update, [(1, 2, 3)])
+
+            record = ctxt.eval("var r = {}; for (var i=0; i<1000; i++) r['f' + i] = i; r")
+
+            self.assertEqual(dict(('f%d' % i, i) for i in range(1000)), record.to_dict())
+
+            indexed = ctxt.eval("({ 0: 'zero', 'x': 1 })")
+
+            self.assertEqual(['0', 'x'], list(indexed.keys()))
+            self.assertEqual([('0', 'zero'), ('x', 1)], indexed.items())
+            self.assertEqual({'0': 'zero', 'x': 1}, indexed.to_dict())
+
+    def testArraySlice(self):
+        with JSContext() as ctxt:
+            queue = ctxt.eval("var q = []; for (var i=0; i<10000; i++) q.push(i); q")
+
+            for i in range(100):
+                del queue[:100]
+
+            self.assertEqual(0, len(queue))
+
+            array = ctxt.eval("[0, 1, 2, 3, 4, 5]")
+
+            self.assertEqual([5, 3, 1], array[::-2])
+            self.assertEqual([0, 2, 4], array[::2])
+
+            array[::2] = ['a', 'b', 'c']
+
+            self.assertEqual(['a', 1, 'b', 3, 'c', 5], list(array))
+            self.assertRaises(ValueError, array.__setitem__, slice(None, None, 2), [1])
+
+            del array[::-2]
+
+            self.assertEqual(['a', 'b', 'c'], list(array))
+
+            array[3:1] = ['d']
+
+            self.assertEqual(['a', 'b', 'c', 'd'], list(array))
+
+            doubles = ctxt.eval("[0.5, 1.5, 2.5, 3.5]")
+
+            doubles[1:2] = [7.5, 8.5, 9.5]
+            del doubles[0:1]
+
+            self.assertEqual([7.5, 8.5, 9.5, 2.5, 3.5], list(doubles))
+            self.assertEqual(5, ctxt.eval("(function (a) { return a.length; })")(doubles))
+
+            ctxt.eval("function literal() { return [1, 2, 3]; }")
+
+            literal = ctxt.locals.literal()
+
+            del literal[:1]
+
+            self.assertEqual([2, 3], list(literal))
+            self.assertEqual([1, 2, 3], list(ctxt.locals.literal()))
+
+            literal = ctxt.locals.literal()
+
+            del literal[1:]
+
+            self.assertEqual([1], list(literal))
+            self.assertEqual([1, 2, 3], list(ctxt.locals.literal()))
+
+            ctxt.eval("function names() { return ['a', 'b', 'c']; }")
+
+            names = ctxt.locals.names()
+
+            del names[1:]
+
+            self.assertEqual(['a'], list(names))
+            self.assertEqual(['a', 'b', 'c'], list(ctxt.locals.names()))
+
+            sparse = ctxt.eval("var s = []; s[100000] = 1; s[5] = 5; s")
+
+            del sparse[:5]
+
+            self.assertEqual(99996, len(sparse))
+            self.assertEqual(5, sparse[0])
+            self.assertEqual(1, sparse[99995])
+
+    def testArrayIterator(self):
+        with JSContext() as ctxt:
+            self.assertEqual(list(range(1000)), list(ctxt.eval("var a = []; for (var i=0; i<1000; i++) a.push(i); a")))
+            self.assertEqual([0.5, 2, -0.0], list(ctxt.eval("[0.5, 2.0, -0]")))
+            self.assertEqual([1, None, 'x', None], list(ctxt.eval("var a = [1, , 'x']; a.length = 4; a")))
+            self.assertEqual(['proto', 2], list(ctxt.eval("Array.prototype[0] = 'proto'; var a = [, 2]; a")))
+            self.assertEqual(3, list(ctxt.eval("[{ 'n': 3 }]"))[0].n)
+            self.assertEqual([], list(ctxt.eval("[]")))
+
+            a = ctxt.eval("var a = {}; a[700] = 7; a.length = 701; Array.prototype.slice.call(a)")
+
+            self.assertEqual(701, len(list(a)))
+            self.assertEqual(7, list(a)[700])
+
+    def testToPython(self):
+        with JSContext() as ctxt:
+            o = ctxt.eval("var shared = [1, 2]; ({ 'a': { 'b': [1, 'x', { 'c': null }] }, 'd': new Date(0), 's': shared, 't': shared })")
+
+            d = o.toPython()
+
+            self.assertEqual({'b': [1, 'x', {'c': None}]}, d['a'])
+            self.assertEqual(datetime, type(d['d']))
+            self.assertTrue(d['s'] is d['t'])
+
+            self.assertEqual(dict, type(o.toPython(depth=1)['a']))
+            self.assertEqual(_PyV8.JSObject, type(o.toPython(depth=0)['a']))
+
+            cyclic = ctxt.eval("var c = { 'n': 1, 'l': [] }; c.l.push(c); c")
+
+            self.assertRaises(ValueError, cyclic.toPython)
+            self.assertRaises(ValueError, cyclic.toPython, cycles='ignore')
+
+            d = cyclic.toPython(cycles='share')
+
+            self.assertTrue(d['l'][0] is d)
+
+    def testToJS(self):
+        with JSContext() as ctxt:
+            shared = {'x': 1}
+            doc = {'a': [1, 2.5, 'three', None, True], 'b': {'c': (1, 2)}, 's1': shared, 's2': shared}
+            doc['self'] = doc
+
+            o = ctxt.toJS(doc)
+
+            self.assertEqual(_PyV8.JSObject, type(o))
+            self.assertEqual('[1,2.5,"three",null,true]', ctxt.eval("JSON.stringify")(o.a))
+            self.assertEqual('{"c":[1,2]}', ctxt.eval("JSON.stringify")(o.b))
+            self.assertTrue(ctxt.eval("(function (o) { return o.s1 === o.s2 && o.self === o; })")(o))
+            self.assertTrue(ctxt.eval("(function (o) { return Array.isArray(o.b.c); })")(o))
+
+            doc['a'].append(6)
+
+            self.assertEqual(5, o.a.length)
+
+            self.assertEqual(doc, ctxt.toJS(doc, deep=False))
+            self.assertEqual(1, ctxt.toJS(1))
+
+    def testConvertHook(self):
+        class Money(object):
+            def __init__(self, cents):
+                self.cents = cents
+
+            def __js__(self):
+                return self.cents / 100.0
+
+        class Id(int):
+            def __js__(self):
+                return 'id-%d' % self
+
+        class Loop(object):
+            def __js__(self):
+                return Loop()
+
+        with JSContext() as ctxt:
+            typeof = ctxt.eval("(function type(value) { return typeof value; })")
+            add = ctxt.eval("(function (a, b) { return a + b; })")
+
+            self.assertEqual('number', typeof(Money(150)))
+            self.assertEqual(3.0, add(Money(150), Money(150)))
+            self.assertEqual('string', typeof(Id(7)))
+            self.assertEqual('id-7', add(Id(7), ''))
+            self.assertEqual('number', typeof(7))
+            self.assertEqual('[1.5,"id-7"]', ctxt.eval("JSON.stringify")(ctxt.toJS([Money(150), Id(7)])))
+
+            self.assertRaises(TypeError, typeof, Loop())
+
+            class Ping(object):
+                def __js__(self):
+                    return Pong()
+
+            class Pong(object):
+                def __js__(self):
+                    return Ping()
+
+            self.assertRaises(RuntimeError, typeof, Ping())
+
+            class Late(object):
+                pass
+
+            self.assertEqual('object', typeof(Late()))
+
+            Late.__js__ = lambda self: 'late'
+
+            self.assertEqual('string', typeof(Late()))
+
+            class Shrinking(object):
+                def __init__(self, items):
+                    self.items = items
+
+                def __js__(self):
+                    del self.items[:]
+                    return 'gone'
+
+            items = [1]
+            items.append(Shrinking(items))
+            items.extend(range(100))
+
+            self.assertEqual(102, ctxt.toJS(items).length)
+            self.assertEqual(0, len(items))
+
+    def testConvertHookTypeCache(self):
+        import gc, weakref
+
+        def makeType():
+            class Temp(object):
+                pass
+
+            return Temp
+
+        def test():
+            with JSContext() as ctxt:
+                typeof = ctxt.eval("(function (value) { return typeof value; })")
+
+                first = makeType()
+                ref = weakref.ref(first)
+
+                typeof(first())
+
+                del first
+
+                for i in range(1100):
+                    typeof(makeType()())
+
+            return ref
+
+        ref = test()
+
+        JSIsolate.default.collect(True)
+        gc.collect()
+
+        self.assertTrue(ref() is None)
+
     def testAutoConverter(self):
         with JSContext() as ctxt:
             ctxt.eval("""
@@ -1206,6 +1578,70 @@ class TestWrapper(unittest.TestCase):
         with JSContext(Global()) as ctxt:
             self.assertEqual("hello flier", ctxt.eval("hello('flier')"))
 
+    def testCallArguments(self):
+        @JSKeywords
+        def format(*args, **kwds):
+            return "%s %s" % (",".join([str(arg) for arg in args]), ",".join(sorted(kwds.keys())))
+
+        def count(*args):
+            return len(args)
+
+        class Global(JSClass):
+            def __init__(self):
+                self.format = format
+                self.count = count
+
+        with JSContext(Global()) as ctxt:
+            self.assertEqual(12, ctxt.eval("count(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12)"))
+            self.assertEqual(0, ctxt.eval("count()"))
+            self.assertEqual(1, ctxt.eval("count({ 'a': 1 })"))
+            self.assertEqual("1,2 a,b", ctxt.eval("format(1, 2, { 'a': 1, 'b': 2 })"))
+            self.assertEqual("1,2 ", ctxt.eval("format(1, 2)"))
+
+    def testTypedSignature(self):
+        @JSSignature('double', 'int32', 'str', returns='double')
+        def price(amount, count, name):
+            self.assertTrue(isinstance(amount, float))
+            self.assertTrue(isinstance(count, int))
+            self.assertEqual(str, type(name))
+
+            return amount * count
+
+        @JSSignature('bool', returns='int32')
+        def flag(value, *args):
+            return int(value) + len(args)
+
+        with JSContext() as ctxt:
+            call = ctxt.eval("(function (f) { return f.apply(this, Array.prototype.slice.call(arguments, 1)); })")
+
+            self.assertEqual(7.5, call(price, 2.5, 3, "item"))
+            self.assertEqual(7.5, call(price, "2.5", 3.9, 123))
+            self.assertEqual(1, call(flag, "yes"))
+            self.assertEqual(2, call(flag, 0, None, "extra"))
+
+            self.assertTrue(ctxt.eval("(function (a, b) { return a === b; })")(price, price))
+
+            called = []
+
+            @JSSignature('int32')
+            def record(n):
+                called.append(n)
+
+            self.assertRaises(JSError, call, record, ctxt.eval("({ valueOf: function () { throw 'fail'; } })"))
+            self.assertEqual([], called)
+
+        @JSKeywords
+        @JSSignature('int32', returns='str')
+        def label(n, **kwds):
+            return "%d %s" % (n, ",".join(sorted(kwds.keys())))
+
+        with JSContext() as ctxt:
+            call = ctxt.eval("(function (f) { return f.apply(this, Array.prototype.slice.call(arguments, 1)); })")
+
+            self.assertEqual("3 a,b", call(label, 3, ctxt.eval("({ 'a': 1, 'b': 2 })")))
+
+        self.assertRaises(TypeError, JSSignature, 'int64')
+
     def testJSFunction(self):
         with JSContext() as ctxt:
             hello = ctxt.eval("(function (name) { return 'hello ' + name; })")
@@ -1223,6 +1659,88 @@ class TestWrapper(unittest.TestCase):
             self.assertEqual("hello flier from tester", hello.apply(tester, ['flier']))
             self.assertEqual("hello flier from json", hello.apply({ 'name': 'json' }, ['flier']))
 
+    def testPreparedCall(self):
+        import math
+
+        with JSContext() as ctxt:
+            obj = ctxt.eval("({ 'base': 10, 'add': function (a, b) { return this.base + a + b; } })")
+
+            add = obj.add.prepare()
+
+            self.assertEqual(13, add(1, 2))
+            self.assertEqual("10ab", add("a", "b"))
+
+            add = obj.add.prepare(argtypes=('int32', 'double'), returns='double')
+
+            self.assertEqual(13.5, add("1", 2.5))
+            self.assertTrue(isinstance(add(1, 2), float))
+            self.assertEqual(11.5, add(1.9, "0.5"))
+            self.assertEqual(11.0, add(2 ** 32 + 1, 0))
+            self.assertEqual(9.0, add(2 ** 32 - 1, 0))
+            self.assertTrue(math.isnan(add("abc", 0)))
+
+            self.assertEqual(2, obj.add.prepare(this={ 'base': 0 }, argtypes=('uint32', 'uint32'), returns='uint32')(-1, 3))
+
+            add = obj.add.prepare(this={ 'base': 100 }, release_gil=True)
+
+            self.assertEqual(103, add(1, 2))
+
+            fail = ctxt.eval("(function () { throw Error('test'); })").prepare()
+
+            self.assertRaises(JSError, fail)
+
+            self.assertRaises(TypeError, obj.add.prepare, argtypes=('int64',))
+
+    def testBatchCall(self):
+        with JSContext() as ctxt:
+            square = ctxt.eval("(function (n) { return n * n; })")
+            add = ctxt.eval("(function (a, b) { return a + b; })")
+
+            self.assertEqual([i * i for i in range(1000)], square.map(range(1000)))
+            self.assertEqual([i * i for i in range(10)], square.map(iter(range(10)), chunk_size=3))
+            self.assertEqual([], square.map([]))
+            self.assertEqual([3, 7, "ab"], add.starmap([(1, 2), [3, 4], ("a", "b")], chunk_size=2))
+
+            obj = ctxt.eval("({ 'base': 10, 'add': function (n) { return this.base + n; } })")
+
+            self.assertEqual([11, 12], obj.add.map([1, 2]))
+            self.assertEqual([101, 102], obj.add.map([1, 2], this={ 'base': 100 }))
+
+            fail = ctxt.eval("(function (n) { if (n > 2) throw Error('test'); return n; })")
+
+            self.assertRaises(JSError, fail.map, range(5))
+            self.assertRaises(ValueError, square.map, range(5), chunk_size=0)
+
+            import array
+
+            out = [None] * 3
+
+            self.assertTrue(out is square.map([1, 2], out=out))
+            self.assertEqual([1, 4, None], out)
+
+            bytes_out = bytearray(2)
+
+            square.map([3, 20], out=bytes_out)
+
+            self.assertEqual([9, 400 & 0xff], list(bytes_out))
+
+            nums = array.array('d', [0.0] * 4)
+
+            square.map(range(4), out=nums, chunk_size=3)
+
+            self.assertEqual([0.0, 1.0, 4.0, 9.0], list(nums))
+
+            # the array of Python 2 doesn't export the new buffer, and assigns the items with the range check
+            if hasattr(memoryview, 'cast'):
+                ints = array.array('i', [0] * 3)
+
+                add.starmap([(1, 2), (2 ** 31, 0), (1.9, 0)], out=ints)
+
+                self.assertEqual([3, -2 ** 31, 1], list(ints))
+
+            self.assertRaises(ValueError, square.map, range(5), out=[0] * 2)
+            self.assertRaises(TypeError, square.map, [1], out=b'x')
+
     def testConstructor(self):
         with JSContext() as ctx:
             ctx.eval("""
@@ -1506,6 +2024,122 @@ class TestWrapper(unittest.TestCase):
 
             [x for x in JSArray([1,2,3])]
 
+    def testArrayBuffer(self):
+        import struct
+
+        with JSIsolate() as isolate:
+            with JSContext() as ctxt:
+                buf = ctxt.eval("var buf = new ArrayBuffer(8); new Int32Array(buf).set([1, -2]); buf")
+
+                self.assertTrue(isinstance(buf, JSArrayBuffer))
+                self.assertEqual(8, len(buf))
+                self.assertEqual((1, -2), struct.unpack_from("<ii", buf))
+
+                arr = ctxt.eval("new Float64Array([1.5, 2.5, 3.5]).subarray(1)")
+
+                self.assertTrue(isinstance(arr, JSTypedArray))
+                self.assertEqual(2, len(arr))
+                self.assertEqual(8, arr.byteoffset)
+                self.assertEqual('d', arr.format)
+                self.assertTrue(isinstance(arr.buffer, JSArrayBuffer))
+
+                if hasattr(memoryview, 'cast'):
+                    view = memoryview(arr)
+
+                    self.assertEqual('d', view.format)
+                    self.assertEqual([2.5, 3.5], view.tolist())
+
+                    ctxt.locals.arr = arr
+                    del arr
+
+                    view[0] = 4.5
+
+                    self.assertEqual(4.5, ctxt.eval("arr[0]"))
+
+                    ctxt.eval("arr = null")
+                    isolate.collect()
+
+                    self.assertEqual([4.5, 3.5], view.tolist())
+
+                pixels = ctxt.eval("var pixels = new Uint8Array(4); pixels")
+
+                memoryview(pixels)[1:3] = b'\x07\x08'
+
+                self.assertEqual("0,7,8,0", ctxt.eval("Array.prototype.join.call(pixels, ',')"))
+
+    def testExternalArrayBuffer(self):
+        import array
+
+        with JSIsolate() as isolate:
+            with JSContext() as ctxt:
+                data = bytearray(b'\x01\x02\x03\x04')
+
+                ctxt.locals.buf = JSArrayBuffer(data)
+
+                self.assertEqual(4, ctxt.eval("buf.byteLength"))
+
+                ctxt.eval("new Uint8Array(buf)[0] = 42")
+
+                self.assertEqual(42, data[0])
+
+                ctxt.locals.nums = JSTypedArray(array.array('d', [1.5, 2.5]))
+
+                self.assertEqual("[object Float64Array]", ctxt.eval("Object.prototype.toString.call(nums)"))
+                self.assertEqual(4.0, ctxt.eval("nums[0] + nums[1]"))
+
+                ctxt.locals.words = JSTypedArray(data, 'H')
+
+                self.assertEqual(2, ctxt.eval("words.length"))
+
+                self.assertRaises(ValueError, JSTypedArray, b'abc', 'H')
+                self.assertRaises(TypeError, JSTypedArray, b'abcd', 'x')
+                self.assertRaises(TypeError, JSArrayBuffer, 123)
+
+                little = sys.byteorder == 'little'
+
+                self.assertEqual(2, len(JSTypedArray(data, '<H' if little else '>H')))
+                self.assertEqual(1, len(JSTypedArray(data, '=l')))
+                self.assertRaises(TypeError, JSTypedArray, data, '>H' if little else '<H')
+
+                text = b'abc'
+
+                ctxt.locals.text = JSArrayBuffer(text)
+                ctxt.eval("new Uint8Array(text)[0] = 65")
+
+                self.assertEqual(b'abc', text)
+                self.assertEqual(65, ctxt.eval("new Uint8Array(text)[0]"))
+
+                ctxt.eval("buf = nums = words = text = null")
+
+                isolate.collect()
+
+            self.assertEqual(42, data[0])
+
+    def testExternalBufferRelease(self):
+        import gc
+
+        data = bytearray(b'\x01\x02\x03\x04')
+
+        isolate = JSIsolate(True)
+
+        with isolate:
+            ctxt = JSContext()
+
+            with ctxt:
+                ctxt.locals.buf = JSArrayBuffer(data)
+
+                self.assertRaises(BufferError, data.extend, b'\x05')
+
+            del ctxt
+
+        # the buffer is still referenced by the isolate, and will be released when the isolate is disposed
+        del isolate
+        gc.collect()
+
+        data.extend(b'\x05')
+
+        self.assertEqual(5, len(data))
+
     def testMultiDimArray(self):
         with JSContext() as ctxt:
             ret = ctxt.eval("""
@@ -1529,6 +2163,31 @@ class TestWrapper(unittest.TestCase):
         with JSContext(Globals()) as ctxt:
             self.assertEqual(2, ctxt.eval("""array[1]"""))
 
+    def testPackedArray(self):
+        import array
+
+        with JSContext() as ctxt:
+            ctxt.locals.check = ctxt.eval("""(function (a) {
+                return [Array.isArray(a), a.length, a.join(',')].join(';');
+            })""")
+
+            self.assertEqual("true;3;1,2,3", ctxt.locals.check(JSArray([1, 2, 3])))
+            self.assertEqual("true;3;1.5,2,-3", ctxt.locals.check(JSArray((1.5, 2, -3))))
+            self.assertEqual("true;2;4294967296,1", ctxt.locals.check(JSArray([2 ** 32, 1])))
+            self.assertEqual("true;3;a,1,true", ctxt.locals.check(JSArray(["a", 1, True])))
+            self.assertEqual("true;2;1099511627776,x", ctxt.locals.check(JSArray([2 ** 40, 'x'])))
+            self.assertEqual("true;1;-1099511627776", ctxt.locals.check(JSArray([-2 ** 40])))
+            self.assertEqual(2 ** 40 + 1, ctxt.eval("(function (n) { return n + 1; })")(2 ** 40))
+            self.assertEqual("true;0;", ctxt.locals.check(JSArray([])))
+            self.assertEqual("true;3;1,2,3", ctxt.locals.check(JSArray(array.array('i', [1, 2, 3]))))
+            self.assertEqual("true;2;0.5,-1", ctxt.locals.check(JSArray(array.array('d', [0.5, -1]))))
+
+            arr = JSArray([1, 2, 3])
+            ctxt.locals.arr = arr
+            ctxt.eval("arr.push(4.5, 'x')")
+
+            self.assertEqual([1, 2, 3, 4.5, 'x'], list(arr))
+
     def testForEach(self):
         class NamedClass(object):
             foo = 1
@@ -1608,6 +2267,31 @@ class TestWrapper(unittest.TestCase):
             now3 = now2.replace(microsecond=123000)
             self.assertEqual(now3, ctxt.locals.identity(now3))
 
+    def testDateTimeZone(self):
+        class FixedOffset(tzinfo):
+            def __init__(self, minutes):
+                self.offset = timedelta(minutes=minutes)
+
+            def utcoffset(self, dt):
+                return self.offset
+
+            def dst(self, dt):
+                return timedelta(0)
+
+        with JSContext() as ctxt:
+            getTime = ctxt.eval("(function (d) { return d.getTime(); })")
+            ctxt.eval("function identity(x) { return x; }")
+
+            self.assertEqual(0, getTime(datetime(1970, 1, 1, tzinfo=FixedOffset(0))))
+            self.assertEqual(-8 * 3600 * 1000, getTime(datetime(1970, 1, 1, tzinfo=FixedOffset(480))))
+            self.assertEqual(1500, getTime(datetime(1970, 1, 1, 0, 0, 1, 500000, tzinfo=FixedOffset(0))))
+
+            for d in [datetime(1969, 12, 31, 23, 59, 59, 999000), datetime(1900, 3, 1, 12), datetime(2038, 6, 1)]:
+                self.assertEqual(d, ctxt.locals.identity(d))
+
+            self.assertEqual(datetime(2000, 2, 29), ctxt.locals.identity(date(2000, 2, 29)))
+            self.assertEqual(None, ctxt.eval("new Date(NaN)"))
+
     def testUnicode(self):
         with JSContext() as ctxt:
             self.assertEqual(u"人", toUnicodeString(ctxt.eval(u"\"人\"")))
@@ -1617,6 +2301,56 @@ class TestWrapper(unittest.TestCase):
 
             self.assertEqual(2, func(u"测试"))
 
+            func = ctxt.eval("(function (msg) { return [msg.length, msg.charCodeAt(0), msg.charCodeAt(msg.length-1)].join(','); })")
+
+            self.assertEqual("3,233,0", func(u"\xe9t\x00"))
+            self.assertEqual("2,20154,35797", func(u"人\u8bd5"))
+
+            if sys.maxunicode > 0xffff:
+                self.assertEqual("3,97,56835", func(u"a\U0001f603"))
+                self.assertEqual(u"\U0001f603", toUnicodeString(ctxt.eval("(function (s) { return s.substr(1); })")(u"a\U0001f603")))
+
+    def testStringConversion(self):
+        with JSContext() as ctxt:
+            self.assertEqual(u"hello", toUnicodeString(ctxt.eval("'hello'")))
+            self.assertEqual(u"caf\xe9", toUnicodeString(ctxt.eval("'caf\\u00e9'")))
+            self.assertEqual(u"\u4eba\u8bd5", toUnicodeString(ctxt.eval("'\\u4eba\\u8bd5'")))
+            self.assertEqual(u"caf\xe9", toUnicodeString(ctxt.eval("('caf\\u00e9\\u4eba').substr(0, 4)")))
+            self.assertEqual(u"a\x00b", toUnicodeString(ctxt.eval("'a\\u0000b'")))
+            self.assertEqual(u"", toUnicodeString(ctxt.eval("''")))
+            self.assertEqual(u"x" * 100000, toUnicodeString(ctxt.eval("new Array(100001).join('x')")))
+
+            if is_py3k:
+                self.assertEqual(u"\U0001f603", ctxt.eval("'\\ud83d\\ude03'"))
+                self.assertEqual(hash(u"caf\xe9"), hash(ctxt.eval("'caf\\u00e9\\u4eba'.substr(0, 4)")))
+
+    def testExternalString(self):
+        with JSIsolate() as isolate:
+            with JSContext() as ctxt:
+                func = ctxt.eval("(function (s) { return [s.length, s.charCodeAt(0), s.charCodeAt(s.length-1)].join(','); })")
+
+                ascii = 'a' * 100000
+                latin = u'\xe9' * 100000
+                wide = u'\u4eba' * 100000
+
+                self.assertEqual("100000,97,97", func(ascii))
+                self.assertEqual("100000,233,233", func(latin))
+                self.assertEqual("100000,20154,20154", func(wide))
+                self.assertEqual("5,97,98", func(b'a' * 4 + b'b'))
+
+                ctxt.locals.latin = latin
+
+                self.assertEqual(u'\xe9\xe9', toUnicodeString(ctxt.eval("latin.substr(0, 2)")))
+                self.assertEqual(0, ctxt.eval("latin.toUpperCase().indexOf('\\u00c9')"))
+
+                ctxt.locals.text = wide
+                del wide
+
+                isolate.collect()
+
+                self.assertEqual(20154, ctxt.eval("text.charCodeAt(99999)"))
+                self.assertEqual(u'\u4eba\u4eba', toUnicodeString(ctxt.eval("text.substr(0, 2)")))
+
     def testClassicStyleObject(self):
         class FileSystemWarpper:
             @property
@@ -1758,6 +2492,117 @@ class TestWrapper(unittest.TestCase):
             self.assertTrue(ctxt.eval("b == b"))
             self.assertTrue(ctxt.eval("o == o"))
 
+    def testWrapperCache(self):
+        with JSContext() as ctxt:
+            ctxt.eval("""
+                var o = { 'name': 'flier', 'hello': function () { return 'hello ' + this.name; } };
+                var a = [1, 2, 3];
+                var t = { 'name': 'tester' };
+            """)
+
+            self.assertTrue(ctxt.locals.o is ctxt.locals.o)
+            self.assertTrue(ctxt.locals.a is ctxt.locals.a)
+            self.assertTrue(ctxt.locals.o.hello is ctxt.locals.o.hello)
+            self.assertFalse(ctxt.locals.o is ctxt.locals.t)
+            self.assertFalse(ctxt.locals.o.hello is ctxt.eval("t.hello = o.hello; t").hello)
+
+            self.assertEqual("hello flier", ctxt.locals.o.hello())
+            self.assertEqual("hello tester", ctxt.locals.t.hello())
+
+    def testTypeTemplate(self):
+        @JSTemplate
+        class Point(object):
+            __slots__ = ('x', 'y')
+
+            def __init__(self, x, y):
+                self.x, self.y = x, y
+
+            @property
+            def sum(self):
+                return self.x + self.y
+
+            def scale(self, n):
+                return Point(self.x * n, self.y * n)
+
+        class Global(JSClass):
+            p = Point(1, 2)
+            o = object()
+
+        with JSContext(Global()) as ctxt:
+            self.assertEqual(3, ctxt.eval("var s = 0; for (var i=0; i<100; i++) s += p.x; s / 100 + p.y"))
+            self.assertEqual(3, ctxt.eval("p.sum"))
+            self.assertEqual(6, ctxt.eval("p.scale(2).y + p.scale(2).x"))
+            self.assertEqual("Point", ctxt.eval("p.constructor.name"))
+
+            ctxt.eval("p.x = 5; p.sum = 0;")
+
+            self.assertEqual(5, Global.p.x)
+            self.assertEqual(7, Global.p.sum)
+
+            # the undeclared attributes still reach the Python object, which has no room for them
+            self.assertEqual("error", ctxt.eval("try { p.z = 7; 'set'; } catch (e) { 'error'; }"))
+            self.assertFalse(hasattr(Global.p, 'z'))
+
+            @JSTemplate
+            class Box(object):
+                def __init__(self):
+                    self.size = 1
+
+            box = Box()
+
+            ctxt.eval("(function (box) { box.size = 2; box.label = 'x'; delete box.size; })")(box)
+
+            self.assertEqual('x', box.label)
+            self.assertFalse(hasattr(box, 'size'))
+
+            self.assertTrue(ctxt.eval("p.scale === p.scale"))
+            self.assertRaises(JSError, ctxt.eval, "p.scale.call(o, 2)")
+
+    def testFunctionTemplateCache(self):
+        class Handler(object):
+            def __init__(self):
+                self.count = 0
+
+            def handle(self, n):
+                self.count += n
+
+        with JSContext() as ctxt:
+            same = ctxt.eval("(function (a, b) { return a === b; })")
+            call = ctxt.eval("(function (f, v) { return f(v); })")
+
+            self.assertTrue(same(len, len))
+            self.assertTrue(same(convert, convert))
+            self.assertTrue(same(Handler, Handler))
+            self.assertEqual(3, call(len, [1, 2, 3]))
+            self.assertEqual("Handler", ctxt.eval("(function (cls) { return new cls().constructor.name; })")(Handler))
+
+            h = Handler()
+
+            for i in range(100):
+                call(h.handle, 1)
+                call(lambda n: h.handle(n), 2)
+
+            self.assertEqual(300, h.count)
+
+    def testFunctionTemplateCacheRelease(self):
+        import gc, weakref
+
+        def test():
+            class Temp(object):
+                pass
+
+            with JSContext() as ctxt:
+                self.assertEqual("function", ctxt.eval("(function (cls) { return typeof cls; })")(Temp))
+
+            return weakref.ref(Temp)
+
+        ref = test()
+
+        JSIsolate.default.collect(True)
+        gc.collect()
+
+        self.assertTrue(ref() is None)
+
     def testNamedSetter(self):
         class Obj(JSClass):
             @property
@@ -51,27 +51,32 @@ T _to_string(v8i::Handle<v8i::String> str)
   {
     if (content.IsAscii())
     {
-        v8i::Vector<const uint8_t> buf = content.ToOneByteVector();
+      v8i::Vector<const uint8_t> buf = content.ToOneByteVector();
 
-      return T((const char *) buf.start(), buf.length());
+      if (utf8::simd::is_ascii((const char *) buf.start(), buf.length()))
+      {
+        return T((const char *) buf.start(), buf.length());
+      }
     }
     else
     {
       v8i::Vector<const v8i::uc16> buf = content.ToUC16Vector();
-      std::vector<char> out;
 
-      utf8::utf16to8(buf.start(), buf.start() + buf.length(), out.begin());
+      if (buf.length() == 0) return T();
 
-      return T(&out[0], out.size());
+      std::vector<char> out(buf.length() * 3);
+
+      size_t len = utf8::simd::utf16_to_utf8(buf.start(), buf.length(), &out[0]);
+
+      if (len != utf8::simd::npos) return T(&out[0], len);
     }
   }
-  else
-  {
-    int len = 0;
-    v8i::SmartArrayPointer<char> buf = str->ToCString(v8i::DISALLOW_NULLS, v8i::FAST_STRING_TRAVERSAL, &len);
 
-    return T(buf.get(), len);
-  }
+  // the Latin-1 strings and unpaired surrogates will be encoded by V8
+  int len = 0;
+  v8i::SmartArrayPointer<char> buf = str->ToCString(v8i::DISALLOW_NULLS, v8i::FAST_STRING_TRAVERSAL, &len);
+
+  return T(buf.get(), len);
 }
 
 inline py::object to_python(v8i::Handle<v8i::String> str)
@@ -30,6 +30,21 @@
 //
 #define SUPPORT_TRACE_LIFECYCLE 1
 
+//
+// Reuse the Python wrapper of a Javascript object in the same context
+//
+#define SUPPORT_WRAPPER_CACHE 1
+
+//
+// Build an ObjectTemplate with native accessors for the Python types marked with JSTemplate
+//
+#define SUPPORT_TYPE_TEMPLATE 1
+
+//
+// Share the buffer of large immutable Python strings with Javascript instead of copying it
+//
+#define SUPPORT_EXTERNAL_STRING 1
+
 //
 // Enable the dtrace or systemtap probes
 //
@@ -70,6 +70,11 @@ void CContext::Expose(void)
 
     .add_property("hasOutOfMemoryException", &CContext::HasOutOfMemoryException)
 
+    .add_property("livingObjects", &CContext::GetLivingObjects,
+                  "The number of living Python objects wrapped in this context.")
+    .add_property("livingMemory", &CContext::GetLivingMemory,
+                  "The memory footprint in bytes of the living Python objects registry.")
+
     .def("eval", &CContext::Evaluate, (py::arg("source"),
                                        py::arg("name") = std::string(),
                                        py::arg("line") = -1,
@@ -81,6 +86,11 @@ void CContext::Expose(void)
                                         py::arg("col") = -1,
                                         py::arg("precompiled") = py::object()))
 
+    .def("toJS", &CContext::ToJS, (py::arg("obj"),
+                                   py::arg("deep") = true),
+         "Convert a Python object to Javascript, the nested dicts, lists and tuples "
+         "are copied to the native Javascript objects and arrays if deep is true.")
+
     .def("enter", &CContext::Enter, "Enter this context. "
          "After entering a context, all code compiled and "
          "run is compiled and run in this context.")
@@ -151,6 +161,8 @@ bool CIsolate::SetMemoryLimit(int max_young_space_size, int max_old_space_size,
   return v8::SetResourceConstraints(m_isolate, &limit);
 }
 
+CIsolate::TimezoneMap CIsolate::s_timezones;
+
 CIsolate::CIsolate(bool owner) : m_owner(owner)
 {
     m_isolate = v8::Isolate::New();
@@ -164,7 +176,7 @@ CIsolate::CIsolate(v8::Isolate *isolate)
 CIsolate::~CIsolate(void)
 {
     if (m_owner)
-        m_isolate->Dispose();
+        Dispose();
 }
 
 void CIsolate::Enter(void)
@@ -179,9 +191,35 @@ void CIsolate::Leave(void)
 
 void CIsolate::Dispose(void)
 {
+#ifdef SUPPORT_TYPE_TEMPLATE
+    TypeTemplateCache::Dispose(m_isolate);
+#endif
+    FunctionTemplateCache::Dispose(m_isolate);
+    PropertyNameCache::Dispose(m_isolate);
+    ConvertHookCache::Dispose(m_isolate);
+    CJavascriptArrayBuffer::Dispose(m_isolate);
+
+    s_timezones.erase(m_isolate);
+
     m_isolate->Dispose();
 }
 
+void CIsolate::CheckTimezone(v8::Isolate *isolate)
+{
+  const char *tz = ::getenv("TZ");
+
+  TimezoneMap::iterator it = s_timezones.find(isolate);
+
+  if (it == s_timezones.end() || it->second.compare(tz ? tz : "") != 0)
+  {
+    s_timezones[isolate] = tz ? tz : "";
+
+    ::tzset();
+
+    v8::Date::DateTimeConfigurationChangeNotification(isolate);
+  }
+}
+
 void CIsolate::Terminate()
 {
     v8::V8::TerminateExecution(m_isolate);
@@ -261,6 +299,36 @@ bool CContext::HasOutOfMemoryException(void)
     return Handle()->HasOutOfMemoryException();
 }
 
+size_t CContext::GetLivingObjects(void)
+{
+#ifdef SUPPORT_TRACE_LIFECYCLE
+    if (m_context.IsEmpty()) return 0;
+
+    v8::HandleScope handle_scope(m_isolate);
+
+    LivingMap *living = ObjectTracer::GetLivingMapping(Handle(), false);
+
+    return living ? living->Size() : 0;
+#else
+    return 0;
+#endif
+}
+
+size_t CContext::GetLivingMemory(void)
+{
+#ifdef SUPPORT_TRACE_LIFECYCLE
+    if (m_context.IsEmpty()) return 0;
+
+    v8::HandleScope handle_scope(m_isolate);
+
+    LivingMap *living = ObjectTracer::GetLivingMapping(Handle(), false);
+
+    return living ? living->MemoryUsage() : 0;
+#else
+    return 0;
+#endif
+}
+
 CContext::CContext(const CContext& context)
 {
   m_isolate = context.Handle()->GetIsolate();
@@ -353,6 +421,17 @@ py::object CContext::Evaluate(const std::string& src,
   return script->Run();
 }
 
+py::object CContext::ToJS(py::object obj, bool deep)
+{
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Context::Scope context_scope(Handle());
+
+  v8::Handle<v8::Value> value = deep ? CPythonObject::Copy(obj, m_isolate) : CPythonObject::Wrap(obj, m_isolate);
+
+  return CJavascriptObject::Wrap(value, m_isolate);
+}
+
 py::object CContext::EvaluateW(const std::wstring& src,
                                const std::wstring name,
                                int line, int col,
@@ -17,6 +17,11 @@ class CIsolate
 {
   v8::Isolate *m_isolate;
   bool m_owner;
+
+  // the TZ environment last notified to the date cache of each isolate, guarded by the GIL
+  typedef std::map<v8::Isolate *, std::string> TimezoneMap;
+
+  static TimezoneMap s_timezones;
   
 private:
   static uint32_t *CalcStackLimitSize(uint32_t size);
@@ -44,6 +49,9 @@ public:
   bool SetStackLimit(uint32_t stack_limit_size);
   
   static py::object GetDefault(void);
+
+  // reload the timezone and drop the cached offsets of isolate, if TZ was changed since its last check
+  static void CheckTimezone(v8::Isolate *isolate);
   
   py::object GetEntered(void);
   py::object GetCurrent(void);
@@ -99,8 +107,13 @@ public:
 
   bool HasOutOfMemoryException(void);
 
+  size_t GetLivingObjects(void);
+  size_t GetLivingMemory(void);
+
   py::object Evaluate(const std::string& src, const std::string name = std::string(),
                       int line = -1, int col = -1, py::object precompiled = py::object());
+  py::object ToJS(py::object obj, bool deep);
+
   py::object EvaluateW(const std::wstring& src, const std::wstring name = std::wstring(),
                        int line = -1, int col = -1, py::object precompiled = py::object());
 
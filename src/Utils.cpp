@@ -2,10 +2,12 @@
 #include "Python.h"
 #endif
 
+#include "Config.h"
 #include "Utils.h"
 
 #include <vector>
 #include <iterator>
+#include <cstring>
 
 #include "utf8.h"
 #include "Locker.h"
@@ -17,6 +19,37 @@ v8::Handle<v8::String> ToString(const std::string& str, v8::Isolate* isolate)
 
   return scope.Escape(v8::String::NewFromUtf8(isolate, str.c_str(), v8::String::kNormalString, str.size()));
 }
+//
+// Encode the UCS4 characters to UTF-16 in a single pass, the buffer is sized for the worst case
+//
+static v8::Local<v8::String> NewFromUcs4(v8::Isolate* isolate, const uint32_t *p, size_t len)
+{
+  if (len == 0) return v8::String::Empty(isolate);
+
+  std::vector<uint16_t> data(len * 2);
+
+  size_t n = 0;
+
+  for (size_t i=0; i<len; i++)
+  {
+    uint32_t c = p[i];
+
+    if (c < 0x10000)
+    {
+      data[n++] = (uint16_t) c;
+    }
+    else
+    {
+      c -= 0x10000;
+
+      data[n++] = (uint16_t) (0xD800 | ((c >> 10) & 0x3FF));
+      data[n++] = (uint16_t) (0xDC00 | (c & 0x3FF));
+    }
+  }
+
+  return v8::String::NewFromTwoByte(isolate, &data[0], v8::String::kNormalString, n);
+}
+
 v8::Handle<v8::String> ToString(const std::wstring& str, v8::Isolate* isolate)
 {
   v8::EscapableHandleScope scope(isolate);
@@ -26,84 +59,280 @@ v8::Handle<v8::String> ToString(const std::wstring& str, v8::Isolate* isolate)
     return scope.Escape(v8::String::NewFromTwoByte(isolate, (const uint16_t *) str.c_str(), v8::String::kNormalString, str.size()));
   }
 
-  std::vector<uint16_t> data(str.size()+1);
+  return scope.Escape(NewFromUcs4(isolate, (const uint32_t *) str.c_str(), str.size()));
+}
+#ifdef SUPPORT_EXTERNAL_STRING
+
+//
+// The strings shorter than it will be copied, since an external string costs
+// a resource object and a Python reference which must be released with the GIL.
+//
+static const Py_ssize_t kExternalStringThreshold = 16 * 1024;
+
+//
+// The external string resource references an immutable Python string and shares its buffer,
+// V8 will dispose it when the string is collected or the isolate is disposed.
+//
+template <typename R, typename T>
+class CPythonStringResource : public R
+{
+  PyObject *m_obj;
+  const T *m_data;
+  size_t m_length;
+public:
+  CPythonStringResource(PyObject *obj, const void *data, size_t length)
+    : m_obj(obj), m_data(static_cast<const T *>(data)), m_length(length)
+  {
+    Py_INCREF(m_obj);
+  }
 
-  for (size_t i=0; i<str.size(); i++)
+  virtual ~CPythonStringResource()
   {
-    data[i] = (uint16_t) str[i];
+    CPythonGIL python_gil;
+
+    Py_DECREF(m_obj);
   }
 
-  data[str.size()] = 0;
+  virtual const T *data() const { return m_data; }
+  virtual size_t length() const { return m_length; }
+};
+
+typedef CPythonStringResource<v8::String::ExternalAsciiStringResource, char> CPythonOneByteStringResource;
+typedef CPythonStringResource<v8::String::ExternalStringResource, uint16_t> CPythonTwoByteStringResource;
+
+static bool IsAscii(const char *data, Py_ssize_t len)
+{
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(data), *end = p + len;
+
+  for (; p + sizeof(size_t) <= end; p += sizeof(size_t))
+  {
+    size_t word;
+
+    memcpy(&word, p, sizeof(word));
 
-  return scope.Escape(v8::String::NewFromTwoByte(isolate, &data[0], v8::String::kNormalString, str.size()));
+    if (word & (size_t(-1) / 0xFF * 0x80)) return false;
+  }
+
+  for (; p < end; p++)
+  {
+    if (*p & 0x80) return false;
+  }
+
+  return true;
 }
+
+#endif
+
 v8::Handle<v8::String> ToString(py::object str, v8::Isolate* isolate)
 {
   v8::EscapableHandleScope scope(isolate);
 
   if (PyBytes_CheckExact(str.ptr()))
   {
+  #ifdef SUPPORT_EXTERNAL_STRING
+    if (PyBytes_GET_SIZE(str.ptr()) >= kExternalStringThreshold &&
+        IsAscii(PyBytes_AS_STRING(str.ptr()), PyBytes_GET_SIZE(str.ptr())))
+    {
+      return scope.Escape(v8::String::NewExternal(isolate,
+        new CPythonOneByteStringResource(str.ptr(), PyBytes_AS_STRING(str.ptr()), PyBytes_GET_SIZE(str.ptr()))));
+    }
+  #endif
+
     return scope.Escape(v8::String::NewFromUtf8(isolate, PyBytes_AS_STRING(str.ptr()), v8::String::kNormalString, PyBytes_GET_SIZE(str.ptr())));
   }
 
   if (PyUnicode_CheckExact(str.ptr()))
   {
-  #ifndef Py_UNICODE_WIDE
-    return scope.Escape(v8::String::NewFromTwoByte(isolate,
-      reinterpret_cast<const uint16_t *>(PyUnicode_AS_UNICODE(str.ptr()))));
+  #if PY_VERSION_HEX >= 0x03030000
+    // read the compact representation of PEP 393 directly
+    if (PyUnicode_READY(str.ptr()) < 0) py::throw_error_already_set();
 
+    Py_ssize_t len = PyUnicode_GET_LENGTH(str.ptr());
+    const void *data = PyUnicode_DATA(str.ptr());
+
+    switch (PyUnicode_KIND(str.ptr()))
+    {
+    case PyUnicode_1BYTE_KIND:
+    #ifdef SUPPORT_EXTERNAL_STRING
+      // the external one byte string must be ASCII, the Latin-1 string is copied
+      if (len >= kExternalStringThreshold && PyUnicode_IS_ASCII(str.ptr()))
+      {
+        return scope.Escape(v8::String::NewExternal(isolate, new CPythonOneByteStringResource(str.ptr(), data, len)));
+      }
+    #endif
+      return scope.Escape(v8::String::NewFromOneByte(isolate, static_cast<const uint8_t *>(data), v8::String::kNormalString, len));
+
+    case PyUnicode_2BYTE_KIND:
+    #ifdef SUPPORT_EXTERNAL_STRING
+      if (len >= kExternalStringThreshold)
+      {
+        return scope.Escape(v8::String::NewExternal(isolate, new CPythonTwoByteStringResource(str.ptr(), data, len)));
+      }
+    #endif
+      return scope.Escape(v8::String::NewFromTwoByte(isolate, static_cast<const uint16_t *>(data), v8::String::kNormalString, len));
+
+    default:
+      return scope.Escape(NewFromUcs4(isolate, static_cast<const uint32_t *>(data), len));
+    }
   #else
     Py_ssize_t len = PyUnicode_GET_SIZE(str.ptr());
-    const uint32_t *p = reinterpret_cast<const uint32_t *>(PyUnicode_AS_UNICODE(str.ptr()));
-
-    std::vector<uint16_t> data(len+1);
 
-    for(Py_ssize_t i=0; i<len; i++)
+  #ifndef Py_UNICODE_WIDE
+  #ifdef SUPPORT_EXTERNAL_STRING
+    if (len >= kExternalStringThreshold)
     {
-      data[i] = (uint16_t) (p[i]);
+      return scope.Escape(v8::String::NewExternal(isolate,
+        new CPythonTwoByteStringResource(str.ptr(), PyUnicode_AS_UNICODE(str.ptr()), len)));
     }
+  #endif
 
-    data[len] = 0;
-
-    return scope.Escape(v8::String::NewFromTwoByte(isolate, &data[0], v8::String::kNormalString, len));
+    return scope.Escape(v8::String::NewFromTwoByte(isolate,
+      reinterpret_cast<const uint16_t *>(PyUnicode_AS_UNICODE(str.ptr())), v8::String::kNormalString, len));
+  #else
+    return scope.Escape(NewFromUcs4(isolate, reinterpret_cast<const uint32_t *>(PyUnicode_AS_UNICODE(str.ptr())), len));
+  #endif
   #endif
   }
 
   return ToString(py::object(py::handle<>(::PyObject_Str(str.ptr()))), isolate);
 }
 
-v8::Handle<v8::String> DecodeUtf8(const std::string& str, v8::Isolate* isolate)
+PyObject *ToPyBytes(v8::Handle<v8::String> str)
 {
-  v8::EscapableHandleScope scope(isolate);
+  int len = str->Utf8Length();
+
+  PyObject *obj = ::PyBytes_FromStringAndSize(NULL, len);
+
+  if (obj) str->WriteUtf8(PyBytes_AS_STRING(obj), len, NULL, v8::String::NO_NULL_TERMINATION);
+
+  return obj;
+}
+
+#if PY_MAJOR_VERSION >= 3
+
+//
+// Write the Javascript string into a freshly allocated Python string of the exact kind,
+// only the two byte strings with Latin-1 characters or surrogates need to be converted again.
+//
+PyObject *ToPyUnicode(v8::Handle<v8::String> str)
+{
+  int len = str->Length();
+
+  if (str->IsOneByte())
+  {
+    // the Python string must use the ASCII representation if possible
+    bool ascii = str->Utf8Length() == len;
+
+    PyObject *obj = ::PyUnicode_New(len, ascii ? 0x7F : 0xFF);
+
+    if (obj) str->WriteOneByte(PyUnicode_1BYTE_DATA(obj), 0, len, v8::String::NO_NULL_TERMINATION);
+
+    return obj;
+  }
 
-  std::vector<uint16_t> data;
+  PyObject *obj = ::PyUnicode_New(len, 0xFFFF);
 
-  try
+  if (!obj) return NULL;
+
+  Py_UCS2 *data = PyUnicode_2BYTE_DATA(obj);
+
+  str->Write(data, 0, len, v8::String::NO_NULL_TERMINATION);
+
+  Py_UCS2 maxchar = 0;
+  bool surrogates = false;
+
+  for (int i=0; i<len; i++)
+  {
+    if (data[i] > maxchar) maxchar = data[i];
+    if (data[i] >= 0xD800 && data[i] < 0xE000) surrogates = true;
+  }
+
+  if (maxchar >= 0x100 && !surrogates) return obj;
+
+  PyObject *result;
+
+  if (surrogates)
   {
-    utf8::utf8to16(str.begin(), str.end(), std::back_inserter(data));
+    int byteorder = PY_LITTLE_ENDIAN ? -1 : 1;
 
-    return scope.Escape(v8::String::NewFromTwoByte(isolate, &data[0], v8::String::kNormalString, data.size()));
+    result = ::PyUnicode_DecodeUTF16(reinterpret_cast<const char *>(data), len * sizeof(Py_UCS2), "surrogatepass", &byteorder);
   }
-  catch (const std::exception&)
+  else
   {
-  	return scope.Escape(v8::String::NewFromUtf8(isolate, str.c_str(), v8::String::kNormalString, str.size()));
+    result = ::PyUnicode_FromKindAndData(PyUnicode_2BYTE_KIND, data, len);
   }
+
+  Py_DECREF(obj);
+
+  return result;
+}
+
+#endif
+
+py::object ToPyString(v8::Handle<v8::String> str)
+{
+#if PY_MAJOR_VERSION >= 3
+  PyObject *obj = ToPyUnicode(str);
+#else
+  PyObject *obj = ToPyBytes(str);
+#endif
+
+  if (!obj) py::throw_error_already_set();
+
+  return py::object(py::handle<>(obj));
+}
+
+v8::Handle<v8::String> DecodeUtf8(const std::string& str, v8::Isolate* isolate)
+{
+  v8::EscapableHandleScope scope(isolate);
+
+  if (utf8::simd::is_ascii(str.c_str(), str.size()))
+  {
+    return scope.Escape(v8::String::NewFromOneByte(isolate, (const uint8_t *) str.c_str(), v8::String::kNormalString, str.size()));
+  }
+
+  std::vector<uint16_t> data(str.size());
+
+  size_t len = utf8::simd::utf8_to_utf16(str.c_str(), str.size(), &data[0]);
+
+  if (len == utf8::simd::npos)
+  {
+    return scope.Escape(v8::String::NewFromUtf8(isolate, str.c_str(), v8::String::kNormalString, str.size()));
+  }
+
+  return scope.Escape(v8::String::NewFromTwoByte(isolate, &data[0], v8::String::kNormalString, len));
 }
 
 const std::string EncodeUtf8(const std::wstring& str, v8::Isolate* isolate)
 {
-  std::vector<uint8_t> data;
+  if (str.empty()) return std::string();
+
+  std::string data(str.size() * (sizeof(wchar_t) == sizeof(uint16_t) ? 3 : 4), 0);
+
+  size_t len = sizeof(wchar_t) == sizeof(uint16_t) ?
+    utf8::simd::utf16_to_utf8((const utf8::uint16_t *) str.c_str(), str.size(), &data[0]) :
+    utf8::simd::utf32_to_utf8((const utf8::uint32_t *) str.c_str(), str.size(), &data[0]);
+
+  if (len != utf8::simd::npos)
+  {
+    data.resize(len);
+
+    return data;
+  }
+
+  // the checked conversion will report the invalid characters
+  std::vector<uint8_t> out;
 
   if (sizeof(wchar_t) == sizeof(uint16_t))
   {
-    utf8::utf16to8(str.begin(), str.end(), std::back_inserter(data));
+    utf8::utf16to8(str.begin(), str.end(), std::back_inserter(out));
   }
   else
   {
-    utf8::utf32to8(str.begin(), str.end(), std::back_inserter(data));
+    utf8::utf32to8(str.begin(), str.end(), std::back_inserter(out));
   }
 
-  return std::string((const char *) &data[0], data.size());
+  return std::string((const char *) &out[0], out.size());
 }
 
 CPythonGIL::CPythonGIL()
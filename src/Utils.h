@@ -117,6 +117,15 @@ v8::Handle<v8::String> ToString(const std::string& str, v8::Isolate* isolate);
 v8::Handle<v8::String> ToString(const std::wstring& str, v8::Isolate* isolate);
 v8::Handle<v8::String> ToString(py::object str, v8::Isolate* isolate);
 
+// convert Javascript string to Python bytes in UTF-8 or unicode, return a new reference
+PyObject *ToPyBytes(v8::Handle<v8::String> str);
+#if PY_MAJOR_VERSION >= 3
+PyObject *ToPyUnicode(v8::Handle<v8::String> str);
+#endif
+
+// convert Javascript string to Python native string, unicode on Python 3 and UTF-8 bytes on Python 2
+py::object ToPyString(v8::Handle<v8::String> str);
+
 v8::Handle<v8::String> DecodeUtf8(const std::string& str, v8::Isolate* isolate);
 const std::string EncodeUtf8(const std::wstring& str, v8::Isolate* isolate);
 
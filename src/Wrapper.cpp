@@ -2,9 +2,11 @@
 
 #include <stdlib.h>
 
+#include <new>
 #include <vector>
+#include <limits>
+#include <algorithm>
 
-#include <boost/preprocessor.hpp>
 #include <boost/python/raw_function.hpp>
 #include <boost/thread/tss.hpp>
 
@@ -58,6 +60,16 @@ void CWrapper::Expose(void)
 
     // Emulating dict object
     .def("keys", &CJavascriptObject::GetAttrList, "Get a list of an object's attributes.")
+    .def("values", &CJavascriptObject::GetValueList, "Get a list of an object's attribute values.")
+    .def("items", &CJavascriptObject::GetItemList, "Get a list of an object's (attribute, value) pairs.")
+    .def("to_dict", &CJavascriptObject::ToDict, "Copy an object's attributes to a new dict.")
+    .def("update", &CJavascriptObject::Update, (py::arg("mapping")),
+         "Update an object's attributes from a mapping or an iterable of (key, value) pairs.")
+
+    .def("toPython", &CJavascriptObject::ToPython,
+         (py::arg("depth") = -1,
+          py::arg("cycles") = "error"),
+         "Convert the arrays and plain objects to Python lists and dicts recursively.")
 
     .def("__getitem__", &CJavascriptObject::GetAttr)
     .def("__setitem__", &CJavascriptObject::SetAttr)
@@ -111,6 +123,33 @@ void CWrapper::Expose(void)
     .def("__contains__", &CJavascriptArray::Contains)
     ;
 
+  py::object array_buffer = py::class_<CJavascriptArrayBuffer, py::bases<CJavascriptObject>, boost::noncopyable>("JSArrayBuffer", py::no_init)
+    .def("__init__", py::make_constructor(&CJavascriptArrayBuffer::Create, py::default_call_policies(),
+                                          (py::arg("buffer"))),
+         "Create an ArrayBuffer over the memory of Python buffer without copying it.")
+
+    .def("__len__", &CJavascriptArrayBuffer::GetByteLength)
+
+    .add_property("bytelength", &CJavascriptArrayBuffer::GetByteLength, "The length of buffer in bytes")
+    ;
+
+  CJavascriptArrayBuffer::SetupBufferProcs(array_buffer);
+
+  py::object typed_array = py::class_<CJavascriptTypedArray, py::bases<CJavascriptArrayBuffer>, boost::noncopyable>("JSTypedArray", py::no_init)
+    .def("__init__", py::make_constructor(&CJavascriptTypedArray::Create, py::default_call_policies(),
+                                          (py::arg("buffer"),
+                                           py::arg("format") = py::object())),
+         "Create a typed array over the memory of Python buffer without copying it.")
+
+    .def("__len__", &CJavascriptTypedArray::Length)
+
+    .add_property("byteoffset", &CJavascriptTypedArray::GetByteOffset, "The offset of view in the buffer")
+    .add_property("format", &CJavascriptTypedArray::GetFormat, "The struct format of items")
+    .add_property("buffer", &CJavascriptTypedArray::GetArrayBuffer, "The referenced ArrayBuffer")
+    ;
+
+  CJavascriptArrayBuffer::SetupBufferProcs(typed_array);
+
   py::class_<CJavascriptFunction, py::bases<CJavascriptObject>, boost::noncopyable>("JSFunction", py::no_init)
     .def("__call__", py::raw_function(&CJavascriptFunction::CallWithArgs))
 
@@ -140,11 +179,41 @@ void CWrapper::Expose(void)
     .add_property("inferredname", &CJavascriptFunction::GetInferredName, "Name inferred from variable or property assignment of this function")
     .add_property("lineoff", &CJavascriptFunction::GetLineOffset, "The line offset of function in the script")
     .add_property("coloff", &CJavascriptFunction::GetColumnOffset, "The column offset of function in the script")
+
+    .def("prepare", &CJavascriptFunction::Prepare,
+         (py::arg("argtypes") = py::object(),
+          py::arg("this") = py::object(),
+          py::arg("returns") = "object",
+          py::arg("release_gil") = false),
+         "Prepare a call site with the types of arguments and result, and the fixed receiver.")
+
+    .def("map", &CJavascriptFunction::Map,
+         (py::arg("iterable"),
+          py::arg("this") = py::object(),
+          py::arg("chunk_size") = 256,
+          py::arg("out") = py::object()),
+         "Call the function with each item of the iterable, and return a list of the results, "
+         "or fill the results into the preallocated sequence or writable buffer of out and return it.")
+    .def("starmap", &CJavascriptFunction::StarMap,
+         (py::arg("iterable"),
+          py::arg("this") = py::object(),
+          py::arg("chunk_size") = 256,
+          py::arg("out") = py::object()),
+         "Call the function with the arguments from each item of the iterable, and return a list of the results, "
+         "or fill the results into the preallocated sequence or writable buffer of out and return it.")
+    ;
+
+  py::class_<CJavascriptCallSite, boost::noncopyable>("JSCallSite", py::no_init)
+    .def("__call__", py::raw_function(&CJavascriptCallSite::CallWithArgs))
     ;
 
   py::objects::class_value_wrapper<boost::shared_ptr<CJavascriptObject>,
     py::objects::make_ptr_instance<CJavascriptObject,
     py::objects::pointer_holder<boost::shared_ptr<CJavascriptObject>,CJavascriptObject> > >();
+
+  py::objects::class_value_wrapper<boost::shared_ptr<CJavascriptCallSite>,
+    py::objects::make_ptr_instance<CJavascriptCallSite,
+    py::objects::pointer_holder<boost::shared_ptr<CJavascriptCallSite>,CJavascriptCallSite> > >();
 }
 
 CJavascriptNull::CJavascriptNull(CIsolatePtr isolate) :
@@ -257,9 +326,9 @@ void CPythonObject::ThrowIf(v8::Isolate* isolate)
 
   #ifdef SUPPORT_TRACE_EXCEPTION_LIFECYCLE
     error->ToObject()->SetHiddenValue(v8::String::NewFromUtf8(isolate, "exc_type"),
-                                      v8::External::New(isolate, ObjectTracer::Trace(error, new py::object(type)).Object()));
+                                      v8::External::New(isolate, ObjectTracer::Trace(error, type).Object()));
     error->ToObject()->SetHiddenValue(v8::String::NewFromUtf8(isolate, "exc_value"),
-                                      v8::External::New(isolate, ObjectTracer::Trace(error, new py::object(value)).Object()));
+                                      v8::External::New(isolate, ObjectTracer::Trace(error, value).Object()));
   #else
     error->ToObject()->SetHiddenValue(v8::String::NewFromUtf8(isolate, "exc_type"),
                                       v8::External::New(isolate, new py::object(type)));
@@ -288,6 +357,28 @@ void CPythonObject::ThrowIf(v8::Isolate* isolate)
 
 #define CALLBACK_RETURN(value) do { info.GetReturnValue().Set(value); return; } while(0);
 
+#ifdef SUPPORT_TYPE_TEMPLATE
+
+//
+// The declared attributes of a type template are served by its accessors and methods,
+// so the named interceptors of the template skip them.
+//
+template <typename T>
+static bool IsDeclaredAttr(const v8::PropertyCallbackInfo<T>& info, const char *name)
+{
+  if (info.Data().IsEmpty() || !info.Data()->IsExternal()) return false;
+
+  const CPythonObject::AttrNames *names = static_cast<const CPythonObject::AttrNames *>(v8::Handle<v8::External>::Cast(info.Data())->Value());
+
+  return names->find(name) != names->end();
+}
+
+#else
+
+template <typename T>
+static bool IsDeclaredAttr(const v8::PropertyCallbackInfo<T>&, const char *) { return false; }
+
+#endif
 
 void CPythonObject::NamedGetter(v8::Local<v8::String> prop, const v8::PropertyCallbackInfo<v8::Value>& info)
 {
@@ -295,12 +386,14 @@ void CPythonObject::NamedGetter(v8::Local<v8::String> prop, const v8::PropertyCa
 
   TRY_HANDLE_EXCEPTION(v8::Undefined(info.GetIsolate()))
 
+  v8::String::Utf8Value name(prop);
+
+  if (IsDeclaredAttr(info, *name)) return;
+
   CPythonGIL python_gil;
 
   py::object obj = CJavascriptObject::Wrap(info.Holder(), info.GetIsolate());
 
-  v8::String::Utf8Value name(prop);
-
   if (PyGen_Check(obj.ptr())) CALLBACK_RETURN(v8::Undefined(info.GetIsolate()));
   
   if (name.length() && **name == '_')
@@ -361,12 +454,14 @@ void CPythonObject::NamedSetter(v8::Local<v8::String> prop, v8::Local<v8::Value>
 
   TRY_HANDLE_EXCEPTION(v8::Undefined(info.GetIsolate()))
 
+  v8::String::Utf8Value name(prop);
+
+  if (IsDeclaredAttr(info, *name)) return;
+
   CPythonGIL python_gil;
 
   py::object obj = CJavascriptObject::Wrap(info.Holder(), info.GetIsolate());
 
-  v8::String::Utf8Value name(prop);
-  
   if (name.length() && **name == '_')
   {
     // return None for every attribute starting with "_"
@@ -428,12 +523,14 @@ void CPythonObject::NamedQuery(v8::Local<v8::String> prop, const v8::PropertyCal
 
   TRY_HANDLE_EXCEPTION(v8::Handle<v8::Integer>())
 
+  v8::String::Utf8Value name(prop);
+
+  if (IsDeclaredAttr(info, *name)) return;
+
   CPythonGIL python_gil;
 
   py::object obj = CJavascriptObject::Wrap(info.Holder(), info.GetIsolate());
 
-  v8::String::Utf8Value name(prop);
-  
   bool exists;
   
   if (name.length() && **name == '_')
@@ -726,29 +823,98 @@ void CPythonObject::IndexedEnumerator(const v8::PropertyCallbackInfo<v8::Array>&
   END_HANDLE_EXCEPTION(v8::Handle<v8::Array>())
 }
 
-#define GEN_ARG(z, n, data) CJavascriptObject::Wrap(info[n], info.GetIsolate())
-#define GEN_ARGS(count) BOOST_PP_ENUM(count, GEN_ARG, NULL)
+//
+// A trailing plain object could be passed as the keyword arguments
+//
+static bool IsKeywordsObject(v8::Handle<v8::Value> value)
+{
+  if (!value->IsObject() || value->IsFunction() || value->IsArray() || value->IsDate() || value->IsRegExp() ||
+      value->IsNativeError() || value->IsNumberObject() || value->IsStringObject() || value->IsBooleanObject())
+    return false;
+
+  return !CPythonObject::IsWrapped(value->ToObject());
+}
+
+static bool AcceptKeywords(py::object callable)
+{
+  PyObject *mark = ::PyObject_GetAttrString(callable.ptr(), "__jskeywords__");
+
+  if (!mark)
+  {
+    ::PyErr_Clear();
+
+    return false;
+  }
+
+  bool accept = ::PyObject_IsTrue(mark) == 1;
+
+  Py_DECREF(mark);
+
+  return accept;
+}
+
+// convert the trailing keywords object to a dict, and drop it from the arguments
+static py::dict PopKeywords(const v8::FunctionCallbackInfo<v8::Value>& info, int& argc)
+{
+  py::dict kwds;
+
+  v8::Handle<v8::Object> obj = info[argc-1]->ToObject();
+  v8::Handle<v8::Array> names = obj->GetOwnPropertyNames();
+
+  for (uint32_t i=0; i<names->Length(); i++)
+  {
+    v8::Handle<v8::Value> name = names->Get(i);
+    v8::String::Utf8Value key(name);
+
+    kwds[py::str(*key, key.length())] = CJavascriptObject::Wrap(obj->Get(name), info.GetIsolate());
+  }
+
+  argc--;
+
+  return kwds;
+}
+
+py::object CPythonObject::Call(py::object callable, const v8::FunctionCallbackInfo<v8::Value>& info)
+{
+  v8::Isolate* isolate = info.GetIsolate();
+
+  int argc = info.Length();
+  py::dict kwds;
+  bool has_kwds = false;
+
+  if (argc > 0 && IsKeywordsObject(info[argc-1]) && AcceptKeywords(callable))
+  {
+    kwds = PopKeywords(info, argc);
+    has_kwds = true;
+  }
+
+#if PY_VERSION_HEX >= 0x03090000
+  if (!has_kwds && argc <= kMaxStackArgs)
+  {
+    // pass the arguments on the stack, the slot before them could be used by the callee
+    py::object holders[kMaxStackArgs];
+    PyObject *stack[kMaxStackArgs + 1];
+
+    for (int i=0; i<argc; i++)
+    {
+      holders[i] = CJavascriptObject::Wrap(info[i], isolate);
+      stack[i+1] = holders[i].ptr();
+    }
+
+    return py::object(py::handle<>(::PyObject_Vectorcall(callable.ptr(), stack + 1,
+                                                         argc | PY_VECTORCALL_ARGUMENTS_OFFSET, NULL)));
+  }
+#endif
 
-#define GEN_CASE_PRED(r, state) \
-  BOOST_PP_NOT_EQUAL( \
-    BOOST_PP_TUPLE_ELEM(2, 0, state), \
-    BOOST_PP_INC(BOOST_PP_TUPLE_ELEM(2, 1, state)) \
-  ) \
-  /**/
+  py::object args(py::handle<>(::PyTuple_New(argc)));
 
-#define GEN_CASE_OP(r, state) \
-  ( \
-    BOOST_PP_INC(BOOST_PP_TUPLE_ELEM(2, 0, state)), \
-    BOOST_PP_TUPLE_ELEM(2, 1, state) \
-  ) \
-  /**/
+  for (int i=0; i<argc; i++)
+  {
+    PyTuple_SET_ITEM(args.ptr(), i, py::incref(CJavascriptObject::Wrap(info[i], isolate).ptr()));
+  }
 
-#define GEN_CASE_MACRO(r, state) \
-  case BOOST_PP_TUPLE_ELEM(2, 0, state): { \
-    result = self(GEN_ARGS(BOOST_PP_TUPLE_ELEM(2, 0, state))); \
-    break; \
-  } \
-  /**/
+  return py::object(py::handle<>(::PyObject_Call(callable.ptr(), args.ptr(), has_kwds ? kwds.ptr() : NULL)));
+}
 
 void CPythonObject::Caller(const v8::FunctionCallbackInfo<v8::Value>& info)
 {
@@ -767,24 +933,17 @@ void CPythonObject::Caller(const v8::FunctionCallbackInfo<v8::Value>& info)
     v8::Handle<v8::External> field = v8::Handle<v8::External>::Cast(info.Data());
 
     self = *static_cast<py::object *>(field->Value());
+
+    const CallPlan *plan = CallPlan::FromPayload(self);
+
+    if (plan) CALLBACK_RETURN(plan->Invoke(info));
   }
   else
   {
     self = CJavascriptObject::Wrap(info.This(), isolate);
   }
 
-  py::object result;
-
-  switch (info.Length())
-  {
-    BOOST_PP_FOR((0, 10), GEN_CASE_PRED, GEN_CASE_OP, GEN_CASE_MACRO)
-  default:
-    info.GetIsolate()->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8(info.GetIsolate(), "too many arguments")));
-
-    CALLBACK_RETURN(v8::Undefined(isolate));
-  }
-
-  CALLBACK_RETURN(Wrap(result, isolate));
+  CALLBACK_RETURN(Wrap(Call(self, info), isolate));
 
   END_HANDLE_EXCEPTION(v8::Undefined(isolate))
 }
@@ -810,6 +969,148 @@ v8::Handle<v8::ObjectTemplate> CPythonObject::CreateObjectTemplate(v8::Isolate *
   return handle_scope.Escape(clazz);
 }
 
+#ifdef SUPPORT_TYPE_TEMPLATE
+
+void CPythonObject::AttrGetter(v8::Local<v8::String>, const v8::PropertyCallbackInfo<v8::Value>& info)
+{
+  v8::HandleScope handle_scope(info.GetIsolate());
+
+  TRY_HANDLE_EXCEPTION(v8::Undefined(info.GetIsolate()))
+
+  CPythonGIL python_gil;
+
+  py::object obj = Unwrap(info.Holder(), info.GetIsolate());
+
+  PyObject *name = static_cast<PyObject *>(v8::Handle<v8::External>::Cast(info.Data())->Value());
+
+  py::object attr(py::handle<>(::PyObject_GetAttr(obj.ptr(), name)));
+
+  CALLBACK_RETURN(Wrap(attr, info.GetIsolate()));
+
+  END_HANDLE_EXCEPTION(v8::Undefined(info.GetIsolate()))
+}
+
+void CPythonObject::AttrSetter(v8::Local<v8::String>, v8::Local<v8::Value> value, const v8::PropertyCallbackInfo<void>& info)
+{
+  v8::HandleScope handle_scope(info.GetIsolate());
+
+  if (v8::V8::IsExecutionTerminating()) return;
+
+  BEGIN_HANDLE_PYTHON_EXCEPTION
+  {
+    CPythonGIL python_gil;
+
+    py::object obj = Unwrap(info.Holder(), info.GetIsolate());
+
+    PyObject *name = static_cast<PyObject *>(v8::Handle<v8::External>::Cast(info.Data())->Value());
+
+    py::object newval = CJavascriptObject::Wrap(value, info.GetIsolate());
+
+    if (::PyObject_SetAttr(obj.ptr(), name, newval.ptr()) < 0) py::throw_error_already_set();
+  }
+  END_HANDLE_PYTHON_EXCEPTION
+}
+
+void CPythonObject::MethodCaller(const v8::FunctionCallbackInfo<v8::Value>& info)
+{
+  v8::Isolate* isolate = info.GetIsolate();
+
+  v8::HandleScope handle_scope(isolate);
+
+  TRY_HANDLE_EXCEPTION(v8::Undefined(isolate));
+
+  CPythonGIL python_gil;
+
+  // the signature of method ensures the holder is an instance of the type template
+  py::object self = Unwrap(info.Holder(), isolate);
+
+  PyObject *name = static_cast<PyObject *>(v8::Handle<v8::External>::Cast(info.Data())->Value());
+
+  py::object method(py::handle<>(::PyObject_GetAttr(self.ptr(), name)));
+
+  CALLBACK_RETURN(Wrap(Call(method, info), isolate));
+
+  END_HANDLE_EXCEPTION(v8::Undefined(isolate))
+}
+
+v8::Handle<v8::ObjectTemplate> CPythonObject::CreateTypeTemplate(v8::Isolate *isolate, py::object type, py::list names, AttrNames& declared)
+{
+  v8::EscapableHandleScope handle_scope(isolate);
+
+  v8::Local<v8::FunctionTemplate> func_tmpl = v8::FunctionTemplate::New(isolate);
+
+  func_tmpl->SetClassName(v8::String::NewFromUtf8(isolate, py::extract<const char *>(type.attr("__name__"))()));
+
+  v8::Local<v8::ObjectTemplate> clazz = func_tmpl->InstanceTemplate();
+  v8::Local<v8::Signature> signature = v8::Signature::New(isolate, func_tmpl);
+
+  clazz->SetInternalFieldCount(1);
+  // V8 consults the interceptor of an object before its own properties, so the interceptors skip the declared names,
+  // the stores and deletes of the other attributes still reach the Python object
+  clazz->SetNamedPropertyHandler(NamedGetter, NamedSetter, NamedQuery, NamedDeleter, NamedEnumerator,
+                                 v8::External::New(isolate, &declared));
+  clazz->SetIndexedPropertyHandler(IndexedGetter, IndexedSetter, IndexedQuery, IndexedDeleter, IndexedEnumerator);
+  clazz->SetCallAsFunctionHandler(Caller);
+
+  py::list keys(py::handle<>(::PyObject_Dir(type.ptr())));
+
+  for (Py_ssize_t i=0; i<PyList_GET_SIZE(keys.ptr()); i++)
+  {
+    py::object key(py::handle<>(py::borrowed(PyList_GET_ITEM(keys.ptr(), i))));
+
+    py::extract<const std::string> extractor(key);
+
+    if (!extractor.check()) continue;
+
+    const std::string name = extractor();
+
+    if (name.empty() || name[0] == '_') continue;
+
+    py::object attr(py::handle<>(py::allow_null(::PyObject_GetAttr(type.ptr(), key.ptr()))));
+
+    if (!attr.ptr())
+    {
+      ::PyErr_Clear();
+      continue;
+    }
+
+    v8::Local<v8::String> prop = v8::String::NewFromUtf8(isolate, name.c_str(), v8::String::kInternalizedString, name.size());
+    v8::Local<v8::External> data = v8::External::New(isolate, key.ptr());
+
+    if (PyObject_TypeCheck(attr.ptr(), &::PyMemberDescr_Type) ||
+        PyObject_TypeCheck(attr.ptr(), &::PyGetSetDescr_Type))
+    {
+      clazz->SetAccessor(prop, AttrGetter, AttrSetter, data);
+    }
+  #ifdef SUPPORT_PROPERTY
+    else if (PyObject_TypeCheck(attr.ptr(), &::PyProperty_Type))
+    {
+      bool readonly = py::object(attr.attr("fset")).is_none();
+
+      clazz->SetAccessor(prop, AttrGetter, readonly ? NULL : AttrSetter, data, v8::DEFAULT,
+                         readonly ? v8::ReadOnly : v8::None);
+    }
+  #endif
+    else if (PyMethod_Check(attr.ptr()) ||
+             (::PyCallable_Check(attr.ptr()) && Py_TYPE(attr.ptr())->tp_descr_get && !Py_TYPE(attr.ptr())->tp_descr_set))
+    {
+      // the functions are bound to the receiver when they are called
+      clazz->Set(prop, v8::FunctionTemplate::New(isolate, MethodCaller, data, signature));
+    }
+    else
+    {
+      continue;
+    }
+
+    names.append(key);
+    declared.insert(name);
+  }
+
+  return handle_scope.Escape(clazz);
+}
+
+#endif // SUPPORT_TYPE_TEMPLATE
+
 bool CPythonObject::IsWrapped(v8::Handle<v8::Object> obj)
 {
   return obj->InternalFieldCount() == 1;
@@ -839,6 +1140,84 @@ void CPythonObject::Dispose(v8::Handle<v8::Value> value, v8::Isolate* isolate)
   }
 }
 
+//
+// Convert between the Python datetime and the Javascript time value with the date cache of isolate,
+// which keeps the UTC offsets of the recent DST segments, so most of the local times are resolved with
+// the arithmetic instead of mktime/localtime. The cache still calls localtime_r when it misses a segment.
+//
+static v8i::DateCache *GetDateCache(v8::Isolate *isolate)
+{
+  CIsolate::CheckTimezone(isolate);
+
+  return reinterpret_cast<v8i::Isolate *>(isolate)->date_cache();
+}
+
+static double ToTimeValue(v8::Isolate *isolate, py::object obj)
+{
+  v8i::DateCache *cache = GetDateCache(isolate);
+
+  int days, ms;
+  bool aware = false;
+
+  if (PyDateTime_CheckExact(obj.ptr()))
+  {
+    days = cache->DaysFromYearMonth(PyDateTime_GET_YEAR(obj.ptr()), PyDateTime_GET_MONTH(obj.ptr()) - 1) +
+           PyDateTime_GET_DAY(obj.ptr()) - 1;
+    ms = ((PyDateTime_DATE_GET_HOUR(obj.ptr()) * 60 + PyDateTime_DATE_GET_MINUTE(obj.ptr())) * 60 +
+          PyDateTime_DATE_GET_SECOND(obj.ptr())) * 1000 + PyDateTime_DATE_GET_MICROSECOND(obj.ptr()) / 1000;
+    aware = reinterpret_cast<PyDateTime_DateTime *>(obj.ptr())->hastzinfo;
+  }
+  else if (PyDate_CheckExact(obj.ptr()))
+  {
+    days = cache->DaysFromYearMonth(PyDateTime_GET_YEAR(obj.ptr()), PyDateTime_GET_MONTH(obj.ptr()) - 1) +
+           PyDateTime_GET_DAY(obj.ptr()) - 1;
+    ms = 0;
+  }
+  else
+  {
+    // the time is placed on the day before 1900-01-01, as the zeroed struct tm did
+    days = cache->DaysFromYearMonth(1900, 0) - 1;
+    ms = (((PyDateTime_TIME_GET_HOUR(obj.ptr()) - 1) * 60 + PyDateTime_TIME_GET_MINUTE(obj.ptr())) * 60 +
+          PyDateTime_TIME_GET_SECOND(obj.ptr())) * 1000 + PyDateTime_TIME_GET_MICROSECOND(obj.ptr()) / 1000;
+    aware = reinterpret_cast<PyDateTime_Time *>(obj.ptr())->hastzinfo;
+  }
+
+  int64_t time_ms = static_cast<int64_t>(days) * v8i::DateCache::kMsPerDay + ms;
+
+  if (aware)
+  {
+    py::object offset = obj.attr("utcoffset")();
+
+    if (PyDelta_Check(offset.ptr()))
+    {
+      PyDateTime_Delta *delta = reinterpret_cast<PyDateTime_Delta *>(offset.ptr());
+
+      return static_cast<double>(time_ms - (static_cast<int64_t>(delta->days) * v8i::DateCache::kSecPerDay +
+                                            delta->seconds) * 1000 - delta->microseconds / 1000);
+    }
+  }
+
+  return static_cast<double>(cache->ToUTC(time_ms));
+}
+
+static py::object FromTimeValue(v8::Isolate *isolate, double value)
+{
+  if (std::isnan(value)) return py::object();
+
+  v8i::DateCache *cache = GetDateCache(isolate);
+
+  int64_t time_ms = cache->ToLocal(static_cast<int64_t>(floor(value)));
+
+  int days = v8i::DateCache::DaysFromTime(time_ms);
+  int ms = v8i::DateCache::TimeInDay(time_ms, days);
+  int year, month, day;
+
+  cache->YearMonthDayFromDays(days, &year, &month, &day);
+
+  return py::object(py::handle<>(::PyDateTime_FromDateAndTime(
+    year, month + 1, day, ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, ms % 1000 * 1000)));
+}
+
 v8::Handle<v8::Value> CPythonObject::Wrap(py::object obj, v8::Isolate* isolate)
 {
   v8::EscapableHandleScope handle_scope(isolate);
@@ -856,6 +1235,18 @@ v8::Handle<v8::Value> CPythonObject::Wrap(py::object obj, v8::Isolate* isolate)
   return handle_scope.Escape(value);
 }
 
+//
+// The integers out of the int32 range are converted to the nearest double,
+// the same as the packed double elements built from a Python sequence.
+//
+static v8::Local<v8::Value> NewNumber(v8::Isolate *isolate, long value)
+{
+  if (value >= std::numeric_limits<int32_t>::min() && value <= std::numeric_limits<int32_t>::max())
+    return v8::Integer::New(isolate, static_cast<int32_t>(value));
+
+  return v8::Number::New(isolate, static_cast<double>(value));
+}
+
 v8::Handle<v8::Value> CPythonObject::WrapInternal(py::object obj, v8::Isolate* isolate)
 {
   assert(isolate->InContext());
@@ -894,26 +1285,41 @@ v8::Handle<v8::Value> CPythonObject::WrapInternal(py::object obj, v8::Isolate* i
     }
 
   #ifdef SUPPORT_TRACE_LIFECYCLE
-    py::object *object = new py::object(obj);
-
-    ObjectTracer::Trace(jsobj.Object(), object);
+    ObjectTracer::Trace(jsobj.Object(), obj);
   #endif
 
     return handle_scope.Escape(jsobj.Object());
   }
 
   v8::Local<v8::Value> result;
+  py::object converted;
 
 #if PY_MAJOR_VERSION < 3
   if (PyInt_CheckExact(obj.ptr()))
   {
-    result = v8::Integer::New(isolate, ::PyInt_AsLong(obj.ptr()));
+    result = NewNumber(isolate, PyInt_AS_LONG(obj.ptr()));
   }
   else
 #endif
   if (PyLong_CheckExact(obj.ptr()))
   {
-    result = v8::Integer::New(isolate, ::PyLong_AsLong(obj.ptr()));
+    int overflow = 0;
+    long value = ::PyLong_AsLongAndOverflow(obj.ptr(), &overflow);
+
+    if (value == -1 && PyErr_OCCURRED()) py::throw_error_already_set();
+
+    if (overflow)
+    {
+      double n = ::PyLong_AsDouble(obj.ptr());
+
+      if (n == -1.0 && PyErr_OCCURRED()) py::throw_error_already_set();
+
+      result = v8::Number::New(isolate, n);
+    }
+    else
+    {
+      result = NewNumber(isolate, value);
+    }
   }
   else if (PyBool_Check(obj.ptr()))
   {
@@ -928,74 +1334,99 @@ v8::Handle<v8::Value> CPythonObject::WrapInternal(py::object obj, v8::Isolate* i
   {
     result = v8::Number::New(isolate, py::extract<double>(obj));
   }
-  else if (PyDateTime_CheckExact(obj.ptr()) || PyDate_CheckExact(obj.ptr()))
+  else if (PyDateTime_CheckExact(obj.ptr()) || PyDate_CheckExact(obj.ptr()) || PyTime_CheckExact(obj.ptr()))
+  {
+    result = v8::Date::New(isolate, ToTimeValue(isolate, obj));
+  }
+  else if (PyCFunction_Check(obj.ptr()) || PyFunction_Check(obj.ptr()) ||
+           PyMethod_Check(obj.ptr()) || PyType_Check(obj.ptr()))
   {
-    tm ts = { 0 };
+    v8::Handle<v8::FunctionTemplate> func_tmpl = FunctionTemplateCache::GetCache(isolate, true)->Get(isolate, obj);
 
-    ts.tm_year = PyDateTime_GET_YEAR(obj.ptr()) - 1900;
-    ts.tm_mon = PyDateTime_GET_MONTH(obj.ptr()) - 1;
-    ts.tm_mday = PyDateTime_GET_DAY(obj.ptr());
-    ts.tm_hour = PyDateTime_DATE_GET_HOUR(obj.ptr());
-    ts.tm_min = PyDateTime_DATE_GET_MINUTE(obj.ptr());
-    ts.tm_sec = PyDateTime_DATE_GET_SECOND(obj.ptr());
-    ts.tm_isdst = -1;
+    if (!func_tmpl.IsEmpty())
+    {
+      result = func_tmpl->GetFunction();
+    }
+    else
+    {
+      py::object payload = CallPlan::CreatePayload(obj);
 
-    int ms = PyDateTime_DATE_GET_MICROSECOND(obj.ptr());
+    #ifdef SUPPORT_TRACE_LIFECYCLE
+      // the payload keeps the callable alive, so it could be found again by the callable
+      ObjectTracer& tracer = ObjectTracer::Allocate(payload, obj.ptr());
+      py::object *object = tracer.Object();
+    #else
+      py::object *object = new py::object(payload);
+    #endif
 
-    result = v8::Date::New(isolate, ((double) mktime(&ts)) * 1000 + ms / 1000);
-  }
-  else if (PyTime_CheckExact(obj.ptr()))
-  {
-    tm ts = { 0 };
+      // the function without a cached template could be collected with its payload
+      v8::Handle<v8::Function> func = v8::Function::New(isolate, Caller, v8::External::New(isolate, object));
 
-    ts.tm_hour = PyDateTime_TIME_GET_HOUR(obj.ptr()) - 1;
-    ts.tm_min = PyDateTime_TIME_GET_MINUTE(obj.ptr());
-    ts.tm_sec = PyDateTime_TIME_GET_SECOND(obj.ptr());
+      if (!func.IsEmpty() && PyType_Check(obj.ptr()))
+      {
+        func->SetName(v8::String::NewFromUtf8(isolate, py::extract<const char *>(obj.attr("__name__"))()));
+      }
 
-    int ms = PyDateTime_TIME_GET_MICROSECOND(obj.ptr());
+      result = func;
 
-    result = v8::Date::New(isolate, ((double) mktime(&ts)) * 1000 + ms / 1000);
+    #ifdef SUPPORT_TRACE_LIFECYCLE
+      if (result.IsEmpty())
+        tracer.Release();
+      else
+        tracer.Trace(result);
+    #endif
+    }
   }
-  else if (PyCFunction_Check(obj.ptr()) || PyFunction_Check(obj.ptr()) ||
-           PyMethod_Check(obj.ptr()) || PyType_Check(obj.ptr()))
+  else if (ConvertHookCache::GetCache(isolate, true)->Convert(obj, converted))
   {
-    v8::Handle<v8::FunctionTemplate> func_tmpl = v8::FunctionTemplate::New(isolate);
-    py::object *object = new py::object(obj);
+    // the hooks may return each other's instances
+    static char s_where[] = " while converting the result of __js__";
 
-    func_tmpl->SetCallHandler(Caller, v8::External::New(isolate, object));
+    if (Py_EnterRecursiveCall(s_where)) py::throw_error_already_set();
 
-    if (PyType_Check(obj.ptr()))
+    try
     {
-      v8::Handle<v8::String> cls_name = v8::String::NewFromUtf8(isolate, py::extract<const char *>(obj.attr("__name__"))());
-
-      func_tmpl->SetClassName(cls_name);
+      result = v8::Local<v8::Value>::New(isolate, Wrap(converted, isolate));
     }
+    catch (...)
+    {
+      Py_LeaveRecursiveCall();
 
-    result = func_tmpl->GetFunction();
+      throw;
+    }
 
-  #ifdef SUPPORT_TRACE_LIFECYCLE
-    if (!result.IsEmpty()) ObjectTracer::Trace(result, object);
-  #endif
+    Py_LeaveRecursiveCall();
   }
   else
   {
-    static boost::thread_specific_ptr< v8::Persistent<v8::ObjectTemplate> > s_template;
-    
-    if( !s_template.get() ) {
-        s_template.reset( new v8::Persistent<v8::ObjectTemplate>(isolate, CreateObjectTemplate(isolate)) );
-    }
-    
-    v8::Handle<v8::Object> instance = v8::Local<v8::ObjectTemplate>::New(isolate, *s_template.get())->NewInstance();
+    v8::Handle<v8::ObjectTemplate> clazz;
 
-    if (!instance.IsEmpty())
+  #ifdef SUPPORT_TYPE_TEMPLATE
+    clazz = TypeTemplateCache::GetCache(isolate, true)->Get(isolate, obj);
+
+    if (clazz.IsEmpty())
+  #endif
     {
-      py::object *object = new py::object(obj);
+      static boost::thread_specific_ptr< v8::Persistent<v8::ObjectTemplate> > s_template;
 
-      instance->SetInternalField(0, v8::External::New(isolate, object));
+      if( !s_template.get() ) {
+          s_template.reset( new v8::Persistent<v8::ObjectTemplate>(isolate, CreateObjectTemplate(isolate)) );
+      }
 
-    #ifdef SUPPORT_TRACE_LIFECYCLE
-      ObjectTracer::Trace(instance, object);
-    #endif
+      clazz = v8::Local<v8::ObjectTemplate>::New(isolate, *s_template.get());
+    }
+
+    v8::Handle<v8::Object> instance = clazz->NewInstance();
+
+    if (!instance.IsEmpty())
+    {
+    #ifdef SUPPORT_TRACE_LIFECYCLE
+      py::object *object = ObjectTracer::Trace(instance, obj).Object();
+    #else
+      py::object *object = new py::object(obj);
+    #endif
+
+      instance->SetInternalField(0, v8::External::New(isolate, object));
     }
 
     result = instance;
@@ -1023,11 +1454,11 @@ void CJavascriptObject::CheckAttr(v8::Handle<v8::String> name) const
   }
 }
 
-py::object CJavascriptObject::GetAttr(const std::string& name)
+py::object CJavascriptObject::GetAttr(py::object name)
 {
 #ifdef SUPPORT_PROBES
   if (WRAPPER_JS_OBJECT_GETATTR_ENABLED()) {
-    WRAPPER_JS_OBJECT_GETATTR(&m_obj, name.c_str());
+    WRAPPER_JS_OBJECT_GETATTR(&m_obj, py::extract<const char *>(name)());
   }
 #endif
 
@@ -1037,23 +1468,24 @@ py::object CJavascriptObject::GetAttr(const std::string& name)
 
   v8::TryCatch try_catch;
 
-  v8::Handle<v8::String> attr_name = DecodeUtf8(name, m_isolate);
-
-  CheckAttr(attr_name);
+  v8::Handle<v8::String> attr_name = PropertyNameCache::ToPropertyName(m_isolate, name);
 
   v8::Handle<v8::Value> attr_value = Object()->Get(attr_name);
 
   if (attr_value.IsEmpty())
     CJavascriptException::ThrowIf(m_isolate, try_catch);
 
+  // only an undefined value needs another lookup to tell a missing attribute apart
+  if (attr_value->IsUndefined()) CheckAttr(attr_name);
+
   return CJavascriptObject::Wrap(attr_value, m_isolate, Object());
 }
 
-void CJavascriptObject::SetAttr(const std::string& name, py::object value)
+void CJavascriptObject::SetAttr(py::object name, py::object value)
 {
 #ifdef SUPPORT_PROBES
   if (WRAPPER_JS_OBJECT_SETATTR_ENABLED()) {
-    WRAPPER_JS_OBJECT_SETATTR(&m_obj, name.c_str(), value.ptr());
+    WRAPPER_JS_OBJECT_SETATTR(&m_obj, py::extract<const char *>(name)(), value.ptr());
   }
 #endif
 
@@ -1063,22 +1495,17 @@ void CJavascriptObject::SetAttr(const std::string& name, py::object value)
 
   v8::TryCatch try_catch;
 
-  v8::Handle<v8::String> attr_name = DecodeUtf8(name, m_isolate);
+  v8::Handle<v8::String> attr_name = PropertyNameCache::ToPropertyName(m_isolate, name);
   v8::Handle<v8::Value> attr_obj = CPythonObject::Wrap(value, m_isolate);
 
-  if (Object()->Has(attr_name))
-  {
-    v8::Handle<v8::Value> UNUSED_VAR(attr_value) = Object()->Get(attr_name);
-  }
-
   if (!Object()->Set(attr_name, attr_obj))
     CJavascriptException::ThrowIf(m_isolate, try_catch);
 }
-void CJavascriptObject::DelAttr(const std::string& name)
+void CJavascriptObject::DelAttr(py::object name)
 {
 #ifdef SUPPORT_PROBES
   if (WRAPPER_JS_OBJECT_DELATTR_ENABLED()) {
-    WRAPPER_JS_OBJECT_DELATTR(&m_obj, name.c_str());
+    WRAPPER_JS_OBJECT_DELATTR(&m_obj, py::extract<const char *>(name)());
   }
 #endif
 
@@ -1088,13 +1515,94 @@ void CJavascriptObject::DelAttr(const std::string& name)
 
   v8::TryCatch try_catch;
 
-  v8::Handle<v8::String> attr_name = DecodeUtf8(name, m_isolate);
+  v8::Handle<v8::String> attr_name = PropertyNameCache::ToPropertyName(m_isolate, name);
 
   CheckAttr(attr_name);
 
   if (!Object()->Delete(attr_name))
     CJavascriptException::ThrowIf(m_isolate, try_catch);
 }
+
+//
+// Visit the enumerable properties of object in one pass, the keys are converted to strings
+// as the property names of Javascript, the same as the deep conversion does.
+//
+template <typename Visitor>
+static void VisitAttrs(v8::Isolate *isolate, v8::Handle<v8::Object> obj, Visitor& visitor)
+{
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::Array> props = obj->GetPropertyNames();
+
+  if (props.IsEmpty()) CJavascriptException::ThrowIf(isolate, try_catch);
+
+  for (uint32_t i=0; i<props->Length(); i++)
+  {
+    v8::HandleScope item_scope(isolate);
+
+    v8::Handle<v8::String> key = props->Get(i)->ToString();
+
+    if (key.IsEmpty()) CJavascriptException::ThrowIf(isolate, try_catch);
+
+    py::object value;
+
+    if (Visitor::kNeedValue)
+    {
+      v8::Handle<v8::Value> item = obj->Get(key);
+
+      if (item.IsEmpty()) CJavascriptException::ThrowIf(isolate, try_catch);
+
+      value = CJavascriptObject::Wrap(item, isolate, obj);
+    }
+
+    visitor(ToPyString(key), value);
+  }
+}
+
+struct KeyCollector
+{
+  static const bool kNeedValue = false;
+
+  py::list& keys;
+
+  KeyCollector(py::list& keys) : keys(keys) {}
+
+  void operator()(py::object key, py::object) { keys.append(key); }
+};
+
+struct ValueCollector
+{
+  static const bool kNeedValue = true;
+
+  py::list& values;
+
+  ValueCollector(py::list& values) : values(values) {}
+
+  void operator()(py::object, py::object value) { values.append(value); }
+};
+
+struct ItemCollector
+{
+  static const bool kNeedValue = true;
+
+  py::list& items;
+
+  ItemCollector(py::list& items) : items(items) {}
+
+  void operator()(py::object key, py::object value) { items.append(py::make_tuple(key, value)); }
+};
+
+struct DictCollector
+{
+  static const bool kNeedValue = true;
+
+  py::dict& attrs;
+
+  DictCollector(py::dict& attrs) : attrs(attrs) {}
+
+  void operator()(py::object key, py::object value) { attrs[key] = value; }
+};
+
 py::list CJavascriptObject::GetAttrList(void)
 {
   CHECK_V8_CONTEXT(m_isolate);
@@ -1106,18 +1614,288 @@ py::list CJavascriptObject::GetAttrList(void)
 
   TERMINATE_EXECUTION_CHECK(attrs);
 
+  KeyCollector collector(attrs);
+
+  VisitAttrs(m_isolate, Object(), collector);
+
+  return attrs;
+}
+
+py::list CJavascriptObject::GetValueList(void)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+  CPythonGIL python_gil;
+
+  py::list values;
+
+  TERMINATE_EXECUTION_CHECK(values);
+
+  ValueCollector collector(values);
+
+  VisitAttrs(m_isolate, Object(), collector);
+
+  return values;
+}
+
+py::list CJavascriptObject::GetItemList(void)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+  CPythonGIL python_gil;
+
+  py::list items;
+
+  TERMINATE_EXECUTION_CHECK(items);
+
+  ItemCollector collector(items);
+
+  VisitAttrs(m_isolate, Object(), collector);
+
+  return items;
+}
+
+py::dict CJavascriptObject::ToDict(void)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+  CPythonGIL python_gil;
+
+  py::dict attrs;
+
+  TERMINATE_EXECUTION_CHECK(attrs);
+
+  DictCollector collector(attrs);
+
+  VisitAttrs(m_isolate, Object(), collector);
+
+  return attrs;
+}
+
+//
+// Convert the arrays and plain objects to Python lists and dicts recursively,
+// the visited objects are tracked by identity so the shared objects are converted once.
+//
+class DeepConverter
+{
+  struct Visited
+  {
+    v8::Local<v8::Object> obj;
+    py::object result;
+    bool done;
+  };
+
+  typedef std::multimap<int, size_t> VisitedMap;
+
+  v8::Isolate *m_isolate;
+  v8::TryCatch& m_try_catch;
+  int m_depth;
+  bool m_share;
+
+  std::vector<Visited> m_visited;
+  VisitedMap m_index;
+
+  Visited *Find(v8::Handle<v8::Object> obj, int hash)
+  {
+    std::pair<VisitedMap::iterator, VisitedMap::iterator> range = m_index.equal_range(hash);
+
+    for (VisitedMap::iterator it = range.first; it != range.second; it++)
+    {
+      if (m_visited[it->second].obj == obj) return &m_visited[it->second];
+    }
+
+    return NULL;
+  }
+
+  size_t Track(v8::Handle<v8::Object> obj, int hash, py::object result)
+  {
+    Visited visited = { v8::Local<v8::Object>::New(m_isolate, obj), result, false };
+
+    m_visited.push_back(visited);
+    m_index.insert(std::make_pair(hash, m_visited.size() - 1));
+
+    return m_visited.size() - 1;
+  }
+
+  v8::Handle<v8::Value> Get(v8::Handle<v8::Object> obj, v8::Handle<v8::Value> key)
+  {
+    v8::Handle<v8::Value> value = obj->Get(key);
+
+    if (value.IsEmpty()) CJavascriptException::ThrowIf(m_isolate, m_try_catch);
+
+    return value;
+  }
+
+  py::object ConvertArray(v8::Handle<v8::Array> array, int level)
+  {
+    py::list result;
+
+    size_t idx = Track(array, array->GetIdentityHash(), result);
+
+    for (uint32_t i=0; i<array->Length(); i++)
+    {
+      result.append(Convert(Get(array, v8::Uint32::New(m_isolate, i)), level + 1));
+    }
+
+    m_visited[idx].done = true;
+
+    return result;
+  }
+
+  py::object ConvertObject(v8::Handle<v8::Object> obj, int level)
+  {
+    py::dict result;
+
+    size_t idx = Track(obj, obj->GetIdentityHash(), result);
+
+    v8::Handle<v8::Array> props = obj->GetPropertyNames();
+
+    if (props.IsEmpty()) CJavascriptException::ThrowIf(m_isolate, m_try_catch);
+
+    for (uint32_t i=0; i<props->Length(); i++)
+    {
+      v8::Handle<v8::Value> key = props->Get(i);
+
+      result[ToPyString(key->ToString())] = Convert(Get(obj, key), level + 1);
+    }
+
+    m_visited[idx].done = true;
+
+    return result;
+  }
+public:
+  DeepConverter(v8::Isolate *isolate, v8::TryCatch& try_catch, int depth, bool share)
+    : m_isolate(isolate), m_try_catch(try_catch), m_depth(depth), m_share(share)
+  {
+  }
+
+  py::object Convert(v8::Handle<v8::Value> value, int level)
+  {
+    if (!value->IsObject() || value->IsDate() || value->IsFunction() ||
+        value->IsStringObject() || value->IsNumberObject() || value->IsBooleanObject() ||
+        value->IsArrayBuffer() || value->IsArrayBufferView())
+    {
+      return CJavascriptObject::Wrap(value, m_isolate);
+    }
+
+    v8::Handle<v8::Object> obj = value.As<v8::Object>();
+
+    if (CPythonObject::IsWrapped(obj) || (m_depth >= 0 && level > m_depth))
+    {
+      return CJavascriptObject::Wrap(obj, m_isolate);
+    }
+
+    Visited *visited = Find(obj, obj->GetIdentityHash());
+
+    if (visited)
+    {
+      if (!visited->done && !m_share)
+        throw CJavascriptException("cyclic structure cannot be converted", ::PyExc_ValueError);
+
+      return visited->result;
+    }
+
+    static char s_where[] = " while converting Javascript object";
+
+    if (Py_EnterRecursiveCall(s_where)) py::throw_error_already_set();
+
+    py::object result;
+
+    try
+    {
+      result = obj->IsArray() ? ConvertArray(obj.As<v8::Array>(), level) : ConvertObject(obj, level);
+    }
+    catch (...)
+    {
+      Py_LeaveRecursiveCall();
+
+      throw;
+    }
+
+    Py_LeaveRecursiveCall();
+
+    return result;
+  }
+};
+
+py::object CJavascriptObject::ToPython(int depth, const std::string& cycles)
+{
+  if (cycles != "error" && cycles != "share")
+    throw CJavascriptException("cycles should be 'error' or 'share'", ::PyExc_ValueError);
+
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  ILazyObject *lazy = dynamic_cast<ILazyObject *>(this);
+
+  if (lazy) lazy->LazyConstructor();
+
+  v8::TryCatch try_catch;
+
+  return DeepConverter(m_isolate, try_catch, depth, cycles == "share").Convert(Object(), 0);
+}
+
+static void SetProperty(v8::Isolate *isolate, v8::Handle<v8::Object> obj, py::object key, py::object value, v8::TryCatch& try_catch)
+{
+  v8::HandleScope item_scope(isolate);
+
+  v8::Handle<v8::Value> attr_name = PyBytes_Check(key.ptr()) || PyUnicode_Check(key.ptr()) ?
+    v8::Handle<v8::Value>(PropertyNameCache::ToPropertyName(isolate, key)) : CPythonObject::Wrap(key, isolate);
+
+  if (!obj->Set(attr_name, CPythonObject::Wrap(value, isolate)))
+    CJavascriptException::ThrowIf(isolate, try_catch);
+}
+
+void CJavascriptObject::Update(py::object mapping)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+  CPythonGIL python_gil;
+
+  TERMINATE_EXECUTION_CHECK(py::throw_error_already_set());
+
   v8::TryCatch try_catch;
 
-  v8::Handle<v8::Array> props = Object()->GetPropertyNames();
+  v8::Handle<v8::Object> obj = Object();
 
-  for (size_t i=0; i<props->Length(); i++)
+  if (PyDict_Check(mapping.ptr()))
   {
-    attrs.append(CJavascriptObject::Wrap(props->Get(v8::Integer::New(m_isolate, i)), m_isolate));
+    // the __js__ hooks may modify the dict, so iterate over a snapshot of its items
+    py::object items(py::handle<>(::PyDict_Items(mapping.ptr())));
+
+    for (Py_ssize_t i=0; i<PyList_GET_SIZE(items.ptr()); i++)
+    {
+      PyObject *item = PyList_GET_ITEM(items.ptr(), i);
+
+      SetProperty(m_isolate, obj, py::object(py::handle<>(py::borrowed(PyTuple_GET_ITEM(item, 0)))),
+                  py::object(py::handle<>(py::borrowed(PyTuple_GET_ITEM(item, 1)))), try_catch);
+    }
+
+    return;
   }
 
-  if (try_catch.HasCaught()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+  py::object items = ::PyObject_HasAttrString(mapping.ptr(), "keys") ? py::object(mapping.attr("items")()) : mapping;
 
-  return attrs;
+  py::object iter(py::handle<>(::PyObject_GetIter(items.ptr())));
+
+  PyObject *item = NULL;
+
+  while (NULL != (item = ::PyIter_Next(iter.ptr())))
+  {
+    py::object pair = py::object(py::handle<>(item));
+
+    if (py::len(pair) != 2)
+      throw CJavascriptException("update requires (key, value) pairs", ::PyExc_ValueError);
+
+    SetProperty(m_isolate, obj, pair[0], pair[1], try_catch);
+  }
+
+  if (PyErr_OCCURRED()) py::throw_error_already_set();
 }
 
 int CJavascriptObject::GetIdentityHash(void)
@@ -1138,7 +1916,7 @@ CJavascriptObjectPtr CJavascriptObject::Clone(void)
   return CJavascriptObjectPtr(new CJavascriptObject(m_isolate, Object()->Clone()));
 }
 
-bool CJavascriptObject::Contains(const std::string& name)
+bool CJavascriptObject::Contains(py::object name)
 {
   CHECK_V8_CONTEXT(m_isolate);
 
@@ -1146,7 +1924,7 @@ bool CJavascriptObject::Contains(const std::string& name)
 
   v8::TryCatch try_catch;
 
-  bool found = Object()->Has(DecodeUtf8(name, m_isolate));
+  bool found = Object()->Has(PropertyNameCache::ToPropertyName(m_isolate, name));
 
   if (try_catch.HasCaught()) CJavascriptException::ThrowIf(m_isolate, try_catch);
 
@@ -1241,15 +2019,11 @@ py::object CJavascriptObject::Wrap(v8::Handle<v8::Value> value, v8::Isolate* iso
   if (value->IsInt32()) return py::object(value->Int32Value());
   if (value->IsString())
   {
-    v8::String::Utf8Value str(v8::Handle<v8::String>::Cast(value));
-
-    return py::str(*str, str.length());
+    return ToPyString(v8::Handle<v8::String>::Cast(value));
   }
   if (value->IsStringObject())
   {
-    v8::String::Utf8Value str(value.As<v8::StringObject>()->ValueOf());
-
-    return py::str(*str, str.length());
+    return ToPyString(value.As<v8::StringObject>()->ValueOf());
   }
   if (value->IsBoolean())
   {
@@ -1269,15 +2043,7 @@ py::object CJavascriptObject::Wrap(v8::Handle<v8::Value> value, v8::Isolate* iso
   }
   if (value->IsDate())
   {
-    double n = v8::Handle<v8::Date>::Cast(value)->NumberValue();
-
-    time_t ts = (time_t) floor(n / 1000);
-
-    tm *t = localtime(&ts);
-
-    return py::object(py::handle<>(::PyDateTime_FromDateAndTime(
-      t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec,
-      ((long long) floor(n)) % 1000 * 1000)));
+    return FromTimeValue(isolate, v8::Handle<v8::Date>::Cast(value)->NumberValue());
   }
 
   return Wrap(value->ToObject(), isolate, self);
@@ -1287,26 +2053,59 @@ py::object CJavascriptObject::Wrap(v8::Handle<v8::Object> obj, v8::Isolate* isol
 {
   v8::HandleScope handle_scope(isolate);
 
-  if (obj.IsEmpty())
+  if (obj.IsEmpty()) return py::object();
+
+  bool is_array = obj->IsArray();
+
+  if (!is_array && CPythonObject::IsWrapped(obj))
   {
-    return py::object();
+    return CPythonObject::Unwrap(obj, isolate);
   }
-  else if (obj->IsArray())
+
+#ifdef SUPPORT_WRAPPER_CACHE
+  WrapperCache *cache = WrapperCache::GetCache(isolate);
+  int hash = 0;
+
+  if (cache)
   {
-    v8::Handle<v8::Array> array = v8::Handle<v8::Array>::Cast(obj);
+    hash = obj->GetIdentityHash();
+
+    py::object wrapper = cache->Find(hash, obj, self);
+
+    if (!wrapper.is_none()) return wrapper;
+  }
+#endif
 
-    return Wrap(new CJavascriptArray(isolate, array), isolate);
+  CJavascriptObject *jsobj;
+
+  if (is_array)
+  {
+    jsobj = new CJavascriptArray(isolate, v8::Handle<v8::Array>::Cast(obj));
   }
-  else if (CPythonObject::IsWrapped(obj))
+  else if (obj->IsArrayBuffer())
   {
-    return CPythonObject::Unwrap(obj, isolate);
+    jsobj = new CJavascriptArrayBuffer(isolate, obj.As<v8::ArrayBuffer>());
+  }
+  else if (obj->IsArrayBufferView())
+  {
+    jsobj = new CJavascriptTypedArray(isolate, obj.As<v8::ArrayBufferView>());
   }
   else if (obj->IsFunction())
   {
-    return Wrap(new CJavascriptFunction(isolate, self, v8::Handle<v8::Function>::Cast(obj)), isolate);
+    jsobj = new CJavascriptFunction(isolate, self, v8::Handle<v8::Function>::Cast(obj));
+  }
+  else
+  {
+    jsobj = new CJavascriptObject(isolate, obj);
   }
 
-  return Wrap(new CJavascriptObject(isolate, obj), isolate);
+  py::object wrapper = Wrap(jsobj, isolate);
+
+#ifdef SUPPORT_WRAPPER_CACHE
+  if (cache && !wrapper.is_none()) cache->Insert(hash, wrapper, jsobj);
+#endif
+
+  return wrapper;
 }
 
 py::object CJavascriptObject::Wrap(CJavascriptObject *obj, v8::Isolate* isolate)
@@ -1334,539 +2133,2576 @@ CJavascriptArray::CJavascriptArray(py::object items)
 {
 }
 
-void CJavascriptArray::LazyConstructor(void)
+//
+// Build the elements of Javascript array in bulk, the homogeneous small integers
+// and numbers will be stored unboxed as the packed SMI or double elements.
+//
+static v8::Handle<v8::Array> NewPackedArray(v8::Isolate *isolate, PyObject **items, size_t size)
 {
-  if (!m_obj.IsEmpty()) return;
+  v8::EscapableHandleScope handle_scope(isolate);
 
-  v8::HandleScope handle_scope(m_isolate);
+  if (size == 0) return handle_scope.Escape(v8::Array::New(isolate, 0));
 
-  v8::Handle<v8::Array> array;
+  if (size > (size_t) v8i::FixedArray::kMaxLength)
+    throw CJavascriptException("too many items for a Javascript array", ::PyExc_OverflowError);
 
-  if (m_items.is_none())
-  {
-    array = v8::Array::New(m_isolate, m_size);
-  }
-#if PY_MAJOR_VERSION < 3
-  else if (PyInt_CheckExact(m_items.ptr()))
-  {
-    m_size = PyInt_AS_LONG(m_items.ptr());
-    array = v8::Array::New(m_isolate, m_size);
-  }
-#endif
-  else if (PyLong_CheckExact(m_items.ptr()))
+  v8i::Factory *factory = reinterpret_cast<v8i::Isolate *>(isolate)->factory();
+
+  bool all_smi = true, all_number = true;
+
+  for (size_t i=0; i<size && all_number; i++)
   {
-    m_size = PyLong_AsLong(m_items.ptr());
-    array = v8::Array::New(m_isolate, m_size);
+  #if PY_MAJOR_VERSION < 3
+    if (PyInt_CheckExact(items[i]))
+    {
+      if (!v8i::Smi::IsValid(PyInt_AS_LONG(items[i]))) all_smi = false;
+    }
+    else
+  #endif
+    if (PyLong_CheckExact(items[i]))
+    {
+      int overflow = 0;
+      long value = ::PyLong_AsLongAndOverflow(items[i], &overflow);
+
+      if (overflow || !v8i::Smi::IsValid(value)) all_smi = false;
+    }
+    else if (PyFloat_CheckExact(items[i]))
+    {
+      all_smi = false;
+    }
+    else
+    {
+      all_smi = all_number = false;
+    }
   }
-  else if (PyList_Check(m_items.ptr()))
+
+  v8i::Handle<v8i::JSArray> array;
+
+  if (all_smi)
   {
-    m_size = PyList_GET_SIZE(m_items.ptr());
-    array = v8::Array::New(m_isolate, m_size);
+    v8i::Handle<v8i::FixedArray> elements = factory->NewFixedArray(size);
+
+    for (size_t i=0; i<size; i++)
+    {
+    #if PY_MAJOR_VERSION < 3
+      long value = PyInt_CheckExact(items[i]) ? PyInt_AS_LONG(items[i]) : ::PyLong_AsLong(items[i]);
+    #else
+      long value = ::PyLong_AsLong(items[i]);
+    #endif
+
+      elements->set(i, v8i::Smi::FromInt(static_cast<int>(value)));
+    }
+
+    array = factory->NewJSArrayWithElements(elements, v8i::FAST_SMI_ELEMENTS);
+  }
+  else if (all_number)
+  {
+    v8i::Handle<v8i::FixedDoubleArray> elements = factory->NewFixedDoubleArray(size);
+
+    for (size_t i=0; i<size; i++)
+    {
+      double value = ::PyFloat_AsDouble(items[i]);
+
+      if (value == -1.0 && PyErr_OCCURRED()) py::throw_error_already_set();
+
+      elements->set(i, value);
+    }
+
+    array = factory->NewJSArrayWithElements(elements, v8i::FAST_DOUBLE_ELEMENTS);
+  }
+  else
+  {
+    // the __js__ hooks may modify the sequence which owns the items, so hold them in a tuple first
+    py::object snapshot(py::handle<>(::PyTuple_New(size)));
+
+    for (size_t i=0; i<size; i++)
+    {
+      Py_INCREF(items[i]);
+      PyTuple_SET_ITEM(snapshot.ptr(), i, items[i]);
+    }
+
+    v8i::Handle<v8i::FixedArray> elements = factory->NewFixedArray(size);
+
+    for (size_t i=0; i<size; i++)
+    {
+      v8::HandleScope item_scope(isolate);
+
+      v8::Handle<v8::Value> value = CPythonObject::Wrap(py::object(py::handle<>(py::borrowed(PyTuple_GET_ITEM(snapshot.ptr(), i)))), isolate);
+
+      elements->set(i, *v8::Utils::OpenHandle(*value));
+    }
+
+    array = factory->NewJSArrayWithElements(elements, v8i::FAST_ELEMENTS);
+  }
+
+  return handle_scope.Escape(v8::Utils::ToLocal(array));
+}
+
+#if PY_MAJOR_VERSION >= 3
+
+template <typename T>
+static v8i::Handle<v8i::JSArray> NewPackedArray(v8i::Factory *factory, const Py_buffer& view)
+{
+  if (view.itemsize != sizeof(T)) return v8i::Handle<v8i::JSArray>();
+
+  const T *data = static_cast<const T *>(view.buf);
+  size_t size = view.len / sizeof(T);
+
+  bool all_smi = std::numeric_limits<T>::is_integer;
+
+  for (size_t i=0; i<size && all_smi; i++)
+  {
+    double value = static_cast<double>(data[i]);
+
+    all_smi = value >= v8i::Smi::kMinValue && value <= v8i::Smi::kMaxValue;
+  }
+
+  if (all_smi)
+  {
+    v8i::Handle<v8i::FixedArray> elements = factory->NewFixedArray(size);
+
+    for (size_t i=0; i<size; i++) elements->set(i, v8i::Smi::FromInt(static_cast<int>(data[i])));
+
+    return factory->NewJSArrayWithElements(elements, v8i::FAST_SMI_ELEMENTS);
+  }
+
+  v8i::Handle<v8i::FixedDoubleArray> elements = factory->NewFixedDoubleArray(size);
+
+  for (size_t i=0; i<size; i++) elements->set(i, static_cast<double>(data[i]));
+
+  return factory->NewJSArrayWithElements(elements, v8i::FAST_DOUBLE_ELEMENTS);
+}
+
+//
+// Read the numbers from a contiguous buffer, such as array.array or numpy array,
+// return an empty handle if the buffer format isn't supported.
+//
+static v8::Handle<v8::Array> NewPackedArray(v8::Isolate *isolate, py::object obj, size_t& size)
+{
+  v8::EscapableHandleScope handle_scope(isolate);
+
+  Py_buffer view;
+
+  if (::PyObject_GetBuffer(obj.ptr(), &view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0)
+  {
+    ::PyErr_Clear();
+
+    return v8::Handle<v8::Array>();
+  }
+
+  const char *format = view.format ? view.format : "B";
+
+  if (*format == '@') format++;
+
+  v8i::Handle<v8i::JSArray> array;
+
+  if (view.ndim <= 1 && view.itemsize > 0 && view.len > 0 && format[0] && !format[1] &&
+      view.len / view.itemsize <= v8i::FixedArray::kMaxLength)
+  {
+    v8i::Factory *factory = reinterpret_cast<v8i::Isolate *>(isolate)->factory();
+
+    switch (format[0])
+    {
+    case 'b': array = NewPackedArray<signed char>(factory, view); break;
+    case 'B': array = NewPackedArray<unsigned char>(factory, view); break;
+    case 'h': array = NewPackedArray<short>(factory, view); break;
+    case 'H': array = NewPackedArray<unsigned short>(factory, view); break;
+    case 'i': array = NewPackedArray<int>(factory, view); break;
+    case 'I': array = NewPackedArray<unsigned int>(factory, view); break;
+    case 'l': array = NewPackedArray<long>(factory, view); break;
+    case 'L': array = NewPackedArray<unsigned long>(factory, view); break;
+    case 'q': array = NewPackedArray<long long>(factory, view); break;
+    case 'Q': array = NewPackedArray<unsigned long long>(factory, view); break;
+    case 'f': array = NewPackedArray<float>(factory, view); break;
+    case 'd': array = NewPackedArray<double>(factory, view); break;
+    }
+
+    if (!array.is_null()) size = view.len / view.itemsize;
+  }
+
+  ::PyBuffer_Release(&view);
+
+  if (array.is_null()) return v8::Handle<v8::Array>();
+
+  return handle_scope.Escape(v8::Utils::ToLocal(array));
+}
+
+#endif
+
+//
+// Copy the nested dicts, lists and tuples to the native Javascript objects and arrays,
+// the copied containers are tracked by identity so the shared and cyclic references are kept.
+//
+class DeepCopier
+{
+  typedef std::map<PyObject *, v8::Local<v8::Object> > CopiedMap;
+
+  v8::Isolate *m_isolate;
+  v8::TryCatch& m_try_catch;
+
+  CopiedMap m_copied;
+  std::vector<py::object> m_containers;  // keep the copied containers alive, so their addresses are not reused
+
+  static bool IsContainer(PyObject *obj)
+  {
+    return PyDict_Check(obj) || PyList_Check(obj) || PyTuple_Check(obj);
+  }
+
+  v8::Handle<v8::Value> ToKey(PyObject *key)
+  {
+    py::object name(py::handle<>(py::borrowed(key)));
+
+    if (PyBytes_Check(key) || PyUnicode_Check(key))
+      return PropertyNameCache::ToPropertyName(m_isolate, name);
+
+    return CPythonObject::Wrap(name, m_isolate);
+  }
+
+  // the nested containers are copied in the outer scope, since they are tracked until the end
+  v8::Handle<v8::Value> CopyChild(PyObject *value)
+  {
+    return IsContainer(value) ? Copy(py::object(py::handle<>(py::borrowed(value)))) : v8::Handle<v8::Value>();
+  }
+
+  void Set(v8::Handle<v8::Object> obj, v8::Handle<v8::Value> key, PyObject *value, v8::Handle<v8::Value> child)
+  {
+    if (!obj->Set(key, child.IsEmpty() ? CPythonObject::Wrap(py::object(py::handle<>(py::borrowed(value))), m_isolate) : child))
+      CJavascriptException::ThrowIf(m_isolate, m_try_catch);
+  }
+
+  v8::Handle<v8::Object> CopyArray(py::object obj)
+  {
+    // the __js__ hooks may modify the list, so copy from a snapshot of its items
+    py::object items(py::handle<>(::PySequence_Tuple(obj.ptr())));
+
+    size_t size = PyTuple_GET_SIZE(items.ptr());
+    PyObject **values = &PyTuple_GET_ITEM(items.ptr(), 0);
+
+    bool nested = false;
+
+    for (size_t i=0; i<size && !nested; i++) nested = IsContainer(values[i]);
+
+    if (!nested)
+    {
+      // the flat arrays are built in bulk, the numbers will be stored unboxed
+      return m_copied[obj.ptr()] = v8::Local<v8::Object>::New(m_isolate, NewPackedArray(m_isolate, values, size));
+    }
+
+    v8::Local<v8::Array> array = v8::Array::New(m_isolate, size);
+
+    m_copied[obj.ptr()] = array;
+
+    for (size_t i=0; i<size; i++)
+    {
+      v8::Handle<v8::Value> child = CopyChild(values[i]);
+
+      v8::HandleScope item_scope(m_isolate);
+
+      Set(array, v8::Uint32::New(m_isolate, i), values[i], child);
+    }
+
+    return array;
+  }
+
+  v8::Handle<v8::Object> CopyObject(py::object obj)
+  {
+    v8::Local<v8::Object> object = v8::Object::New(m_isolate);
+
+    m_copied[obj.ptr()] = object;
+
+    py::object items(py::handle<>(::PyDict_Items(obj.ptr())));
+
+    for (Py_ssize_t i=0; i<PyList_GET_SIZE(items.ptr()); i++)
+    {
+      PyObject *key = PyTuple_GET_ITEM(PyList_GET_ITEM(items.ptr(), i), 0),
+               *value = PyTuple_GET_ITEM(PyList_GET_ITEM(items.ptr(), i), 1);
+
+      v8::Handle<v8::Value> child = CopyChild(value);
+
+      v8::HandleScope item_scope(m_isolate);
+
+      Set(object, ToKey(key), value, child);
+    }
+
+    return object;
+  }
+public:
+  DeepCopier(v8::Isolate *isolate, v8::TryCatch& try_catch)
+    : m_isolate(isolate), m_try_catch(try_catch)
+  {
+  }
+
+  v8::Handle<v8::Value> Copy(py::object obj)
+  {
+    if (!IsContainer(obj.ptr())) return CPythonObject::Wrap(obj, m_isolate);
+
+    CopiedMap::const_iterator it = m_copied.find(obj.ptr());
+
+    if (it != m_copied.end()) return it->second;
+
+    static char s_where[] = " while copying Python object";
+
+    if (Py_EnterRecursiveCall(s_where)) py::throw_error_already_set();
+
+    m_containers.push_back(obj);
 
-    for (Py_ssize_t i=0; i< (Py_ssize_t) m_size; i++)
+    v8::Handle<v8::Object> result;
+
+    try
+    {
+      result = PyDict_Check(obj.ptr()) ? CopyObject(obj) : CopyArray(obj);
+    }
+    catch (...)
     {
-      array->Set(v8::Uint32::New(m_isolate, i), CPythonObject::Wrap(py::object(py::handle<>(py::borrowed(PyList_GET_ITEM(m_items.ptr(), i)))), m_isolate));
+      Py_LeaveRecursiveCall();
+
+      throw;
     }
+
+    Py_LeaveRecursiveCall();
+
+    return result;
+  }
+};
+
+v8::Handle<v8::Value> CPythonObject::Copy(py::object obj, v8::Isolate* isolate)
+{
+  assert(isolate->InContext());
+
+  v8::EscapableHandleScope handle_scope(isolate);
+
+  v8::TryCatch try_catch;
+
+  CPythonGIL python_gil;
+
+  return handle_scope.Escape(v8::Local<v8::Value>::New(isolate, DeepCopier(isolate, try_catch).Copy(obj)));
+}
+
+void CJavascriptArray::LazyConstructor(void)
+{
+  if (!m_obj.IsEmpty()) return;
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Handle<v8::Array> array;
+
+  if (m_items.is_none())
+  {
+    array = v8::Array::New(m_isolate, m_size);
+  }
+#if PY_MAJOR_VERSION < 3
+  else if (PyInt_CheckExact(m_items.ptr()))
+  {
+    m_size = PyInt_AS_LONG(m_items.ptr());
+    array = v8::Array::New(m_isolate, m_size);
   }
-  else if (PyTuple_Check(m_items.ptr()))
+#endif
+  else if (PyLong_CheckExact(m_items.ptr()))
   {
-    m_size = PyTuple_GET_SIZE(m_items.ptr());
+    m_size = PyLong_AsLong(m_items.ptr());
     array = v8::Array::New(m_isolate, m_size);
+  }
+  else if (PyList_Check(m_items.ptr()) || PyTuple_Check(m_items.ptr()))
+  {
+    m_size = PySequence_Fast_GET_SIZE(m_items.ptr());
+    array = NewPackedArray(m_isolate, PySequence_Fast_ITEMS(m_items.ptr()), m_size);
+  }
+  else if (PyGen_Check(m_items.ptr()))
+  {
+    array = v8::Array::New(m_isolate);
+
+    py::object iter(py::handle<>(::PyObject_GetIter(m_items.ptr())));
+
+    m_size = 0;
+    PyObject *item = NULL;
+
+    while (NULL != (item = ::PyIter_Next(iter.ptr())))
+    {
+      array->Set(v8::Uint32::New(m_isolate, m_size++), CPythonObject::Wrap(py::object(py::handle<>(py::borrowed(item))), m_isolate));
+    }
+  }
+  else if (::PySequence_Check(m_items.ptr()) && !PyBytes_Check(m_items.ptr()) && !PyUnicode_Check(m_items.ptr()))
+  {
+  #if PY_MAJOR_VERSION >= 3
+    if (PyObject_CheckBuffer(m_items.ptr())) array = NewPackedArray(m_isolate, m_items, m_size);
+
+    if (array.IsEmpty())
+  #endif
+    {
+      py::object items(py::handle<>(::PySequence_Fast(m_items.ptr(), "expected a sequence")));
+
+      m_size = PySequence_Fast_GET_SIZE(items.ptr());
+      array = NewPackedArray(m_isolate, PySequence_Fast_ITEMS(items.ptr()), m_size);
+    }
+  }
+
+  m_obj.Reset(m_isolate, array);
+}
+size_t CJavascriptArray::Length(void)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  LazyConstructor();
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  return v8::Handle<v8::Array>::Cast(Object())->Length();
+}
+//
+// Move the elements of a fast elements array in its backing store,
+// return false if the array should fall back to the element by element access.
+//
+static bool MoveFastElements(v8i::Handle<v8i::JSArray> array, uint32_t dst, uint32_t src, uint32_t count)
+{
+  if (array->map()->is_observed()) return false;
+
+  if (array->HasFastDoubleElements())
+  {
+    if (count > 0)
+    {
+      double *data = v8i::FixedDoubleArray::cast(array->elements())->data_start();
 
-    for (Py_ssize_t i=0; i< (Py_ssize_t) m_size; i++)
+      memmove(data + dst, data + src, count * sizeof(double));
+    }
+  }
+  else if (array->HasFastSmiOrObjectElements())
+  {
+    // the literal arrays share a copy-on-write backing store, which must be copied before any write
+    v8i::Handle<v8i::FixedArray> elements = v8i::JSObject::EnsureWritableFastElements(array);
+
+    if (count > 0) array->GetHeap()->MoveElements(*elements, dst, src, count);
+  }
+  else
+  {
+    return false;
+  }
+
+  return true;
+}
+
+// remove the items in [start, stop) and shift the following items down
+static void DeleteRange(v8::Isolate *isolate, v8::Handle<v8::Array> array, uint32_t start, uint32_t stop, v8::TryCatch& try_catch)
+{
+  uint32_t length = array->Length(), count = stop - start;
+
+  if (count == 0) return;
+
+  if (!MoveFastElements(v8::Utils::OpenHandle(*array), start, stop, length - stop))
+  {
+    for (uint32_t idx=stop; idx<length; idx++)
     {
-      array->Set(v8::Uint32::New(m_isolate, i), CPythonObject::Wrap(py::object(py::handle<>(py::borrowed(PyTuple_GET_ITEM(m_items.ptr(), i)))), m_isolate));
+      v8::Handle<v8::Value> value = array->Get(idx);
+
+      if (value.IsEmpty() || !array->Set(idx - count, value)) CJavascriptException::ThrowIf(isolate, try_catch);
     }
   }
-  else if (PyGen_Check(m_items.ptr()))
+
+  // shrinking the length fills the tail with holes, and trims the backing store when most of it is unused
+  if (!array->Set(v8::String::NewFromUtf8(isolate, "length"), v8::Uint32::New(isolate, length - count)))
+    CJavascriptException::ThrowIf(isolate, try_catch);
+}
+
+// open a gap of count items at the index, the gap should be filled by the caller
+static void InsertRange(v8::Isolate *isolate, v8::Handle<v8::Array> array, uint32_t at, uint32_t count, v8::TryCatch& try_catch)
+{
+  uint32_t length = array->Length();
+
+  if (count == 0 || at >= length) return;
+
+  // move the last item first, so the backing store will be grown at once
+  v8::Handle<v8::Value> last = array->Get(length - 1);
+
+  if (last.IsEmpty() || !array->Set(length + count - 1, last)) CJavascriptException::ThrowIf(isolate, try_catch);
+
+  if (MoveFastElements(v8::Utils::OpenHandle(*array), at + count, at, length - 1 - at)) return;
+
+  for (uint32_t idx=length-1; idx-- > at; )
+  {
+    v8::Handle<v8::Value> value = array->Get(idx);
+
+    if (value.IsEmpty() || !array->Set(idx + count, value)) CJavascriptException::ThrowIf(isolate, try_catch);
+  }
+}
+
+py::object CJavascriptArray::GetItem(py::object key)
+{
+#ifdef SUPPORT_PROBES
+  if (WRAPPER_JS_ARRAY_GETITEM_ENABLED()) {
+    WRAPPER_JS_ARRAY_GETITEM(&m_obj, key.ptr());
+  }
+#endif
+
+  CHECK_V8_CONTEXT(m_isolate);
+
+  LazyConstructor();
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::TryCatch try_catch;
+
+  if (PySlice_Check(key.ptr()))
+  {
+    Py_ssize_t arrayLen = v8::Handle<v8::Array>::Cast(Object())->Length();
+    Py_ssize_t start, stop, step, sliceLen;
+
+    if (0 == ::PySlice_GetIndicesEx(PySlice_Cast(key.ptr()), arrayLen, &start, &stop, &step, &sliceLen))
+    {
+      std::vector<py::object> items;
+
+      if (step == 1)
+      {
+        GetItems(start, sliceLen, items);
+      }
+      else
+      {
+        items.reserve(sliceLen);
+
+        for (Py_ssize_t i=0, idx=start; i<sliceLen; i++, idx+=step)
+        {
+          v8::Handle<v8::Value> value = Object()->Get(v8::Integer::New(m_isolate, (uint32_t) idx));
+
+          if (value.IsEmpty()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+
+          items.push_back(CJavascriptObject::Wrap(value, m_isolate, Object()));
+        }
+      }
+
+      py::object slice(py::handle<>(::PyList_New(sliceLen)));
+
+      for (Py_ssize_t i=0; i<sliceLen; i++)
+      {
+        PyList_SET_ITEM(slice.ptr(), i, py::incref(items[i].ptr()));
+      }
+
+      return slice;
+    }
+  }
+  else if (PyInt_Check(key.ptr()) || PyLong_Check(key.ptr()))
+  {
+    uint32_t idx = PyInt_Check(key.ptr()) ? (uint32_t) ::PyInt_AsUnsignedLongMask(key.ptr()) : (uint32_t) ::PyLong_AsUnsignedLong(key.ptr());
+
+    if (!Object()->Has(idx)) return py::object();
+
+    v8::Handle<v8::Value> value = Object()->Get(v8::Integer::New(m_isolate, idx));
+
+    if (value.IsEmpty()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+
+    return CJavascriptObject::Wrap(value, m_isolate, Object());
+  }
+
+  throw CJavascriptException("list indices must be integers", ::PyExc_TypeError);
+}
+
+void CJavascriptArray::GetItems(size_t start, size_t count, std::vector<py::object>& items)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  LazyConstructor();
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::Array> array = v8::Handle<v8::Array>::Cast(Object());
+  v8i::Handle<v8i::JSArray> obj = v8::Utils::OpenHandle(*array);
+
+  items.clear();
+  items.reserve(count);
+
+  for (size_t idx=start; idx<start+count; idx++)
+  {
+    // the elements are fetched again for each item, since the conversion may cause GC
+    if (obj->HasFastSmiOrObjectElements() && idx < (size_t) v8i::FixedArray::cast(obj->elements())->length())
+    {
+      v8i::Object *value = v8i::FixedArray::cast(obj->elements())->get((int) idx);
+
+      if (!value->IsTheHole())
+      {
+        items.push_back(CJavascriptObject::Wrap(v8::Utils::ToLocal(v8i::Handle<v8i::Object>(value, obj->GetIsolate())), m_isolate, array));
+
+        continue;
+      }
+    }
+    else if (obj->HasFastDoubleElements() && idx < (size_t) v8i::FixedArrayBase::cast(obj->elements())->length())
+    {
+      v8i::FixedDoubleArray *elements = v8i::FixedDoubleArray::cast(obj->elements());
+
+      if (!elements->is_the_hole((int) idx))
+      {
+        double value = elements->get_scalar((int) idx);
+
+        items.push_back(v8i::IsInt32Double(value) ? py::object(static_cast<int>(value)) :
+                        py::object(py::handle<>(::PyFloat_FromDouble(value))));
+
+        continue;
+      }
+    }
+
+    // the holes and slow elements may be found in the prototype chain
+    if (!array->Has((uint32_t) idx))
+    {
+      items.push_back(py::object());
+
+      continue;
+    }
+
+    v8::Handle<v8::Value> value = array->Get((uint32_t) idx);
+
+    if (value.IsEmpty()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+
+    items.push_back(CJavascriptObject::Wrap(value, m_isolate, array));
+  }
+}
+
+py::object CJavascriptArray::SetItem(py::object key, py::object value)
+{
+#ifdef SUPPORT_PROBES
+  if (WRAPPER_JS_ARRAY_SETITEM_ENABLED()) {
+    WRAPPER_JS_ARRAY_SETITEM(&m_obj, key.ptr(), value.ptr());
+  }
+#endif
+
+  CHECK_V8_CONTEXT(m_isolate);
+
+  LazyConstructor();
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::TryCatch try_catch;
+
+  if (PySlice_Check(key.ptr()))
+  {
+    // the __js__ hooks may modify the assigned list, so assign from a snapshot of its items
+    py::object values(py::handle<>(::PySequence_Tuple(value.ptr())));
+
+    Py_ssize_t itemSize = PyTuple_GET_SIZE(values.ptr());
+    PyObject **items = &PyTuple_GET_ITEM(values.ptr(), 0);
+
+    v8::Handle<v8::Array> array = v8::Handle<v8::Array>::Cast(Object());
+
+    Py_ssize_t arrayLen = array->Length();
+    Py_ssize_t start, stop, step, sliceLen;
+
+    if (0 != ::PySlice_GetIndicesEx(PySlice_Cast(key.ptr()), arrayLen, &start, &stop, &step, &sliceLen))
+      py::throw_error_already_set();
+
+    if (step == 1)
+    {
+      if (stop < start) stop = start;
+
+      if (itemSize < sliceLen)
+      {
+        DeleteRange(m_isolate, array, start + itemSize, stop, try_catch);
+      }
+      else if (itemSize > sliceLen)
+      {
+        InsertRange(m_isolate, array, stop, itemSize - sliceLen, try_catch);
+      }
+    }
+    else if (itemSize != sliceLen)
+    {
+      std::ostringstream oss;
+
+      oss << "attempt to assign sequence of size " << itemSize << " to extended slice of size " << sliceLen;
+
+      throw CJavascriptException(oss.str(), ::PyExc_ValueError);
+    }
+
+    for (Py_ssize_t i=0, idx=start; i<itemSize; i++, idx+=step)
+    {
+      v8::HandleScope item_scope(m_isolate);
+
+      if (!array->Set((uint32_t) idx, CPythonObject::Wrap(py::object(py::handle<>(py::borrowed(items[i]))), m_isolate)))
+        CJavascriptException::ThrowIf(m_isolate, try_catch);
+    }
+  }
+  else if (PyInt_Check(key.ptr()) || PyLong_Check(key.ptr()))
+  {
+    uint32_t idx = PyInt_Check(key.ptr()) ? (uint32_t) ::PyInt_AsUnsignedLongMask(key.ptr()) : (uint32_t) ::PyLong_AsUnsignedLong(key.ptr());
+
+    if (!Object()->Set(v8::Integer::New(m_isolate, idx), CPythonObject::Wrap(value, m_isolate)))
+      CJavascriptException::ThrowIf(m_isolate, try_catch);
+  }
+
+  return value;
+}
+py::object CJavascriptArray::DelItem(py::object key)
+{
+#ifdef SUPPORT_PROBES
+  if (WRAPPER_JS_ARRAY_DELITEM_ENABLED()) {
+    WRAPPER_JS_ARRAY_DELITEM(&m_obj, key.ptr());
+  }
+#endif
+
+  CHECK_V8_CONTEXT(m_isolate);
+
+  LazyConstructor();
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::TryCatch try_catch;
+
+  if (PySlice_Check(key.ptr()))
+  {
+    v8::Handle<v8::Array> array = v8::Handle<v8::Array>::Cast(Object());
+
+    Py_ssize_t arrayLen = array->Length();
+    Py_ssize_t start, stop, step, sliceLen;
+
+    if (0 != ::PySlice_GetIndicesEx(PySlice_Cast(key.ptr()), arrayLen, &start, &stop, &step, &sliceLen))
+      py::throw_error_already_set();
+
+    if (sliceLen == 0) return py::object();
+
+    if (step == 1)
+    {
+      DeleteRange(m_isolate, array, start, stop, try_catch);
+    }
+    else
+    {
+      if (step < 0)
+      {
+        start += (sliceLen - 1) * step;
+        step = -step;
+      }
+
+      // compact the kept items down, then truncate the array
+      Py_ssize_t dst = start;
+
+      for (Py_ssize_t idx=start; idx<arrayLen; idx++)
+      {
+        if ((idx - start) % step == 0 && (idx - start) / step < sliceLen) continue;
+
+        v8::Handle<v8::Value> value = array->Get((uint32_t) idx);
+
+        if (value.IsEmpty() || !array->Set((uint32_t) dst++, value)) CJavascriptException::ThrowIf(m_isolate, try_catch);
+      }
+
+      if (!array->Set(v8::String::NewFromUtf8(m_isolate, "length"), v8::Uint32::New(m_isolate, (uint32_t) dst)))
+        CJavascriptException::ThrowIf(m_isolate, try_catch);
+    }
+
+    return py::object();
+  }
+  else if (PyInt_Check(key.ptr()) || PyLong_Check(key.ptr()))
+  {
+    uint32_t idx = PyInt_Check(key.ptr()) ? (uint32_t) ::PyInt_AsUnsignedLongMask(key.ptr()) : (uint32_t) ::PyLong_AsUnsignedLong(key.ptr());
+
+    py::object value;
+
+    if (Object()->Has(idx))
+      value = CJavascriptObject::Wrap(Object()->Get(v8::Integer::New(m_isolate, idx)), m_isolate, Object());
+
+    if (!Object()->Delete(idx))
+      CJavascriptException::ThrowIf(m_isolate, try_catch);
+
+    return value;
+  }
+
+  throw CJavascriptException("list indices must be integers", ::PyExc_TypeError);
+}
+
+bool CJavascriptArray::Contains(py::object item)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  LazyConstructor();
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::TryCatch try_catch;
+
+  for (size_t i=0; i<Length(); i++)
+  {
+    if (Object()->Has(i))
+    {
+      v8::Handle<v8::Value> value = Object()->Get(v8::Integer::New(m_isolate, i));
+
+      if (try_catch.HasCaught()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+
+      if (item == CJavascriptObject::Wrap(value, m_isolate, Object()))
+      {
+        return true;
+      }
+    }
+  }
+
+  if (try_catch.HasCaught()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+
+  return false;
+}
+
+CJavascriptArrayBuffer::CJavascriptArrayBuffer(v8::Isolate* isolate, v8::Handle<v8::ArrayBuffer> buffer)
+  : CJavascriptObject(isolate, buffer), m_data(NULL), m_length(0), m_itemsize(1), m_shape(0), m_format("B")
+{
+  ReadContents(buffer, 0, buffer->ByteLength());
+}
+
+bool CJavascriptArrayBuffer::ReadContents(v8::Handle<v8::ArrayBuffer> buffer, size_t offset, size_t length)
+{
+  v8i::Handle<v8i::JSArrayBuffer> obj = v8::Utils::OpenHandle(*buffer);
+
+  char *data = static_cast<char *>(obj->backing_store());
+
+  // the externalized buffer drops its memory when it is neutered, and so do the views of it
+  if (!data && obj->is_external())
+  {
+    m_data = NULL;
+    m_length = m_shape = 0;
+
+    return false;
+  }
+
+  m_data = data ? data + offset : NULL;
+  m_length = length;
+  m_shape = length / m_itemsize;
+
+  return true;
+}
+
+bool CJavascriptArrayBuffer::Update(void)
+{
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Handle<v8::ArrayBuffer> buffer = Object().As<v8::ArrayBuffer>();
+
+  return ReadContents(buffer, 0, buffer->ByteLength());
+}
+
+//
+// Hold the Python buffer until the externalized ArrayBuffer is collected by V8,
+// or until the isolate is disposed, since the weak callbacks are not called then.
+//
+class ExternalBuffer
+{
+  Py_buffer m_view;
+  v8::Isolate *m_isolate;
+  v8::Persistent<v8::ArrayBuffer> m_buffer;
+
+  // the live buffers of each isolate, guarded by the GIL
+  typedef std::map<v8::Isolate *, std::set<ExternalBuffer *> > BufferMap;
+
+  static BufferMap s_buffers;
+
+  static void WeakCallback(const v8::WeakCallbackData<v8::ArrayBuffer, ExternalBuffer>& data)
+  {
+    CPythonGIL python_gil;
+
+    ExternalBuffer *buffer = data.GetParameter();
+
+    s_buffers[buffer->m_isolate].erase(buffer);
+
+    delete buffer;
+  }
+public:
+  ExternalBuffer(py::object obj) : m_isolate(NULL)
+  {
+    memset(&m_view, 0, sizeof(m_view));
+
+    if (PyObject_CheckBuffer(obj.ptr()))
+    {
+      if (::PyObject_GetBuffer(obj.ptr(), &m_view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0) py::throw_error_already_set();
+    }
+    else
+    {
+    #if PY_MAJOR_VERSION < 3
+      const void *buf = NULL;
+      Py_ssize_t len = 0;
+
+      if (::PyObject_AsReadBuffer(obj.ptr(), &buf, &len) < 0) py::throw_error_already_set();
+
+      if (::PyBuffer_FillInfo(&m_view, obj.ptr(), const_cast<void *>(buf), len, 1, PyBUF_SIMPLE) < 0) py::throw_error_already_set();
+    #else
+      throw CJavascriptException("a bytes-like object is required", ::PyExc_TypeError);
+    #endif
+    }
+  }
+
+  ~ExternalBuffer(void)
+  {
+    CPythonGIL python_gil;
+
+    m_buffer.Reset();
+
+    ::PyBuffer_Release(&m_view);
+  }
+
+  const Py_buffer& View(void) const { return m_view; }
+  const char *Format(void) const { return m_view.format ? m_view.format : "B"; }
+
+  void Trace(v8::Isolate *isolate, v8::Handle<v8::ArrayBuffer> buffer)
+  {
+    m_isolate = isolate;
+    m_buffer.Reset(isolate, buffer);
+    m_buffer.SetWeak(this, WeakCallback);
+
+    s_buffers[isolate].insert(this);
+  }
+
+  static void Dispose(v8::Isolate *isolate)
+  {
+    BufferMap::iterator it = s_buffers.find(isolate);
+
+    if (it == s_buffers.end()) return;
+
+    std::set<ExternalBuffer *> buffers;
+
+    buffers.swap(it->second);
+    s_buffers.erase(it);
+
+    for (std::set<ExternalBuffer *>::iterator buf = buffers.begin(); buf != buffers.end(); buf++)
+    {
+      delete *buf;
+    }
+  }
+};
+
+ExternalBuffer::BufferMap ExternalBuffer::s_buffers;
+
+void CJavascriptArrayBuffer::Dispose(v8::Isolate *isolate)
+{
+  ExternalBuffer::Dispose(isolate);
+}
+
+v8::Handle<v8::ArrayBuffer> CJavascriptArrayBuffer::NewExternal(v8::Isolate* isolate, std::auto_ptr<ExternalBuffer> external)
+{
+  v8::EscapableHandleScope handle_scope(isolate);
+
+  const Py_buffer& view = external->View();
+
+  // the Javascript code could write to any ArrayBuffer, so the read-only buffer is copied
+  if (view.readonly)
+  {
+    v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, view.len);
+
+    if (view.len) memcpy(v8::Utils::OpenHandle(*buffer)->backing_store(), view.buf, view.len);
+
+    return handle_scope.Escape(buffer);
+  }
+
+  v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, view.buf, view.len);
+
+  external.release()->Trace(isolate, buffer);
+
+  return handle_scope.Escape(buffer);
+}
+
+CJavascriptArrayBufferPtr CJavascriptArrayBuffer::Create(py::object obj)
+{
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+
+  CHECK_V8_CONTEXT(isolate);
+
+  v8::HandleScope handle_scope(isolate);
+
+  std::auto_ptr<ExternalBuffer> external(new ExternalBuffer(obj));
+
+  return CJavascriptArrayBufferPtr(new CJavascriptArrayBuffer(isolate, NewExternal(isolate, external)));
+}
+
+static Py_ssize_t s_byteStride = 1;
+
+int CJavascriptArrayBuffer::GetBuffer(PyObject *exporter, Py_buffer *view, int flags)
+{
+  CJavascriptArrayBuffer *buffer = NULL;
+
+  try
+  {
+    buffer = py::extract<CJavascriptArrayBuffer *>(exporter);
+  }
+  catch (const py::error_already_set&)
+  {
+    return -1;
+  }
+
+  if (!buffer->Update())
+  {
+    ::PyErr_SetString(::PyExc_BufferError, "the ArrayBuffer is neutered");
+
+    return -1;
+  }
+
+  // without the format, the consumer will treat the buffer as unsigned bytes
+  bool typed = (flags & PyBUF_FORMAT) == PyBUF_FORMAT;
+
+  view->obj = exporter;
+  Py_INCREF(exporter);
+
+  view->buf = buffer->m_data ? buffer->m_data : const_cast<char *>("");
+  view->len = buffer->m_length;
+  view->readonly = 0;
+  view->itemsize = typed ? buffer->m_itemsize : 1;
+  view->format = typed ? const_cast<char *>(buffer->m_format) : NULL;
+  view->ndim = 1;
+  view->shape = (flags & PyBUF_ND) == PyBUF_ND ? (typed ? &buffer->m_shape : &buffer->m_length) : NULL;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? (typed ? &buffer->m_itemsize : &s_byteStride) : NULL;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+
+  return 0;
+}
+
+#if PY_MAJOR_VERSION < 3
+
+Py_ssize_t CJavascriptArrayBuffer::GetReadBuffer(PyObject *exporter, Py_ssize_t segment, void **ptr)
+{
+  if (segment != 0)
+  {
+    ::PyErr_SetString(::PyExc_SystemError, "accessing non-existent buffer segment");
+
+    return -1;
+  }
+
+  CJavascriptArrayBuffer *buffer = NULL;
+
+  try
+  {
+    buffer = py::extract<CJavascriptArrayBuffer *>(exporter);
+  }
+  catch (const py::error_already_set&)
+  {
+    return -1;
+  }
+
+  if (!buffer->Update())
+  {
+    ::PyErr_SetString(::PyExc_BufferError, "the ArrayBuffer is neutered");
+
+    return -1;
+  }
+
+  *ptr = buffer->m_data ? buffer->m_data : const_cast<char *>("");
+
+  return buffer->m_length;
+}
+
+Py_ssize_t CJavascriptArrayBuffer::GetWriteBuffer(PyObject *exporter, Py_ssize_t segment, void **ptr)
+{
+  return GetReadBuffer(exporter, segment, ptr);
+}
+
+Py_ssize_t CJavascriptArrayBuffer::GetCharBuffer(PyObject *exporter, Py_ssize_t segment, char **ptr)
+{
+  return GetReadBuffer(exporter, segment, reinterpret_cast<void **>(ptr));
+}
+
+Py_ssize_t CJavascriptArrayBuffer::GetSegCount(PyObject *exporter, Py_ssize_t *len)
+{
+  if (len)
+  {
+    try
+    {
+      *len = py::extract<CJavascriptArrayBuffer *>(exporter)()->GetByteLength();
+    }
+    catch (const py::error_already_set&)
+    {
+      ::PyErr_Clear();
+
+      *len = 0;
+    }
+  }
+
+  return 1;
+}
+
+#endif
+
+void CJavascriptArrayBuffer::SetupBufferProcs(py::object cls)
+{
+  static PyBufferProcs s_bufferProcs;
+
+#if PY_MAJOR_VERSION < 3
+  s_bufferProcs.bf_getreadbuffer = GetReadBuffer;
+  s_bufferProcs.bf_getwritebuffer = GetWriteBuffer;
+  s_bufferProcs.bf_getsegcount = GetSegCount;
+  s_bufferProcs.bf_getcharbuffer = GetCharBuffer;
+#endif
+  s_bufferProcs.bf_getbuffer = GetBuffer;
+  s_bufferProcs.bf_releasebuffer = NULL;
+
+  PyTypeObject *type = reinterpret_cast<PyTypeObject *>(cls.ptr());
+
+  type->tp_as_buffer = &s_bufferProcs;
+#if PY_MAJOR_VERSION < 3
+  type->tp_flags |= Py_TPFLAGS_HAVE_NEWBUFFER | Py_TPFLAGS_HAVE_GETCHARBUFFER;
+#endif
+}
+
+template <typename T>
+static v8::Local<v8::TypedArray> NewTypedArray(v8::Handle<v8::ArrayBuffer> buffer, size_t offset, size_t length)
+{
+  return T::New(buffer, offset, length);
+}
+
+static const struct TypedArrayType
+{
+  bool (v8::Value::*check)(void) const;
+  v8::Local<v8::TypedArray> (*create)(v8::Handle<v8::ArrayBuffer> buffer, size_t offset, size_t length);
+  const char *format;
+  Py_ssize_t itemsize;
+} s_typedArrayTypes[] = {
+  { &v8::Value::IsInt8Array, NewTypedArray<v8::Int8Array>, "b", 1 },
+  { &v8::Value::IsUint8Array, NewTypedArray<v8::Uint8Array>, "B", 1 },
+  { &v8::Value::IsUint8ClampedArray, NewTypedArray<v8::Uint8ClampedArray>, "B", 1 },
+  { &v8::Value::IsInt16Array, NewTypedArray<v8::Int16Array>, "h", 2 },
+  { &v8::Value::IsUint16Array, NewTypedArray<v8::Uint16Array>, "H", 2 },
+  { &v8::Value::IsInt32Array, NewTypedArray<v8::Int32Array>, "i", 4 },
+  { &v8::Value::IsUint32Array, NewTypedArray<v8::Uint32Array>, "I", 4 },
+  { &v8::Value::IsFloat32Array, NewTypedArray<v8::Float32Array>, "f", 4 },
+  { &v8::Value::IsFloat64Array, NewTypedArray<v8::Float64Array>, "d", 8 },
+};
+
+CJavascriptTypedArray::CJavascriptTypedArray(v8::Isolate* isolate, v8::Handle<v8::ArrayBufferView> view)
+  : CJavascriptArrayBuffer(isolate, v8::Handle<v8::Object>(view)), m_offset(view->ByteOffset())
+{
+  for (size_t i=0; i<sizeof(s_typedArrayTypes)/sizeof(s_typedArrayTypes[0]); i++)
+  {
+    if (((*view)->*s_typedArrayTypes[i].check)())
+    {
+      m_format = s_typedArrayTypes[i].format;
+      m_itemsize = s_typedArrayTypes[i].itemsize;
+      break;
+    }
+  }
+
+  ReadContents(view->Buffer(), m_offset, view->ByteLength());
+}
+
+bool CJavascriptTypedArray::Update(void)
+{
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Handle<v8::ArrayBufferView> view = Object().As<v8::ArrayBufferView>();
+
+  m_offset = view->ByteOffset();
+
+  return ReadContents(view->Buffer(), m_offset, view->ByteLength());
+}
+
+//
+// Find the typed array type of the struct format, which must be in the native byte order
+//
+static const TypedArrayType *FindTypedArrayType(const std::string& format)
+{
+  std::string code = format;
+  bool standard = false;
+
+  if (!code.empty() && strchr("@=<>!", code[0]))
+  {
+    const uint16_t one = 1;
+    bool little = *reinterpret_cast<const uint8_t *>(&one) == 1;
+
+    if (code[0] == (little ? '>' : '<') || (code[0] == '!' && little)) return NULL;
+
+    // except '@', the prefixes use the standard sizes
+    standard = code[0] != '@';
+
+    code.erase(0, 1);
+  }
+
+  if (code == "c") code = "B";
+  if ((standard || sizeof(long) == 4) && code == "l") code = "i";
+  if ((standard || sizeof(long) == 4) && code == "L") code = "I";
+
+  for (size_t i=0; i<sizeof(s_typedArrayTypes)/sizeof(s_typedArrayTypes[0]); i++)
+  {
+    if (code == s_typedArrayTypes[i].format) return &s_typedArrayTypes[i];
+  }
+
+  return NULL;
+}
+
+CJavascriptTypedArrayPtr CJavascriptTypedArray::Create(py::object obj, py::object format)
+{
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+
+  CHECK_V8_CONTEXT(isolate);
+
+  v8::HandleScope handle_scope(isolate);
+
+  std::auto_ptr<ExternalBuffer> external(new ExternalBuffer(obj));
+
+  std::string fmt = format.is_none() ? std::string(external->Format()) : std::string(py::extract<std::string>(format));
+
+  const TypedArrayType *type = FindTypedArrayType(fmt);
+
+  if (!type) throw CJavascriptException("unsupported buffer format '" + fmt + "'", ::PyExc_TypeError);
+
+  if (external->View().len % type->itemsize)
+    throw CJavascriptException("buffer size must be a multiple of the item size", ::PyExc_ValueError);
+
+  v8::Handle<v8::ArrayBuffer> buffer = NewExternal(isolate, external);
+
+  v8::Handle<v8::TypedArray> view = type->create(buffer, 0, buffer->ByteLength() / type->itemsize);
+
+  return CJavascriptTypedArrayPtr(new CJavascriptTypedArray(isolate, view));
+}
+
+py::object CJavascriptTypedArray::GetArrayBuffer(void)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  return CJavascriptObject::Wrap(v8::Handle<v8::Object>(Object().As<v8::ArrayBufferView>()->Buffer()), m_isolate);
+}
+
+py::object CJavascriptFunction::CallWithArgs(py::tuple args, py::dict kwds)
+{
+  size_t argc = ::PyTuple_Size(args.ptr());
+
+  if (argc == 0) throw CJavascriptException("missed self argument", ::PyExc_TypeError);
+
+  py::object self = args[0];
+  py::extract<CJavascriptFunction&> extractor(self);
+
+  if (!extractor.check()) throw CJavascriptException("missed self argument", ::PyExc_TypeError);
+
+  CJavascriptFunction& func = extractor();
+  
+  CHECK_V8_CONTEXT(func.m_isolate);
+  
+  v8::HandleScope handle_scope(func.m_isolate);
+  v8::TryCatch try_catch;
+
+  py::list argv(args.slice(1, py::_));
+
+  return func.Call(func.Self(), argv, kwds);
+}
+
+py::object CJavascriptFunction::Call(v8::Handle<v8::Object> self, py::list args, py::dict kwds)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+
+  size_t args_count = ::PyList_Size(args.ptr()), kwds_count = ::PyMapping_Size(kwds.ptr());
+
+  std::vector< v8::Handle<v8::Value> > params(args_count + kwds_count);
+
+  for (size_t i=0; i<args_count; i++)
+  {
+    params[i] = CPythonObject::Wrap(args[i], m_isolate);
+  }
+
+  py::list values = kwds.values();
+
+  for (size_t i=0; i<kwds_count; i++)
+  {
+    params[args_count+i] = CPythonObject::Wrap(values[i], m_isolate);
+  }
+
+  v8::Handle<v8::Value> result;
+
+  Py_BEGIN_ALLOW_THREADS
+
+  result = func->Call(
+    self.IsEmpty() ? m_isolate->GetCurrentContext()->Global() : self,
+    params.size(), params.empty() ? NULL : &params[0]);
+
+  Py_END_ALLOW_THREADS
+
+  if (result.IsEmpty()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+
+  return CJavascriptObject::Wrap(result, m_isolate);
+}
+
+v8::Handle<v8::Object> CJavascriptFunction::GetReceiver(py::object self) const
+{
+  if (self.is_none()) return Self();
+
+  py::extract<CJavascriptObject&> extractor(self);
+
+  return extractor.check() ? extractor().Object() : CPythonObject::Wrap(self, m_isolate)->ToObject();
+}
+
+//
+// Fill the results of a batch call into a preallocated output. A writable buffer in the typed array formats
+// gets the numbers stored as the typed array does, other sequences are assigned item by item.
+//
+class BatchOutput
+{
+  py::object m_out;
+  Py_buffer m_view;
+  const TypedArrayType *m_type;
+  Py_ssize_t m_size, m_count;
+
+  template <typename T>
+  void Store(T value)
+  {
+    memcpy(static_cast<char *>(m_view.buf) + m_count * sizeof(T), &value, sizeof(T));
+  }
+public:
+  BatchOutput(py::object out) : m_out(out), m_type(NULL), m_size(0), m_count(0)
+  {
+    memset(&m_view, 0, sizeof(m_view));
+
+    if (PyObject_CheckBuffer(out.ptr()))
+    {
+      if (::PyObject_GetBuffer(out.ptr(), &m_view, PyBUF_WRITABLE | PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) == 0)
+      {
+        m_type = FindTypedArrayType(m_view.format ? m_view.format : "B");
+
+        if (m_type && m_type->itemsize == m_view.itemsize)
+        {
+          m_size = m_view.len / m_view.itemsize;
+          return;
+        }
+
+        m_type = NULL;
+
+        ::PyBuffer_Release(&m_view);
+      }
+      else
+      {
+        // the read-only buffer is left to the sequence protocol, which reports the error
+        ::PyErr_Clear();
+      }
+    }
+
+    m_size = ::PySequence_Size(out.ptr());
+
+    if (m_size < 0) py::throw_error_already_set();
+  }
+
+  ~BatchOutput(void)
+  {
+    if (m_type) ::PyBuffer_Release(&m_view);
+  }
+
+  void Append(v8::Isolate *isolate, v8::Handle<v8::Value> value, v8::TryCatch& try_catch)
+  {
+    if (m_count >= m_size) throw CJavascriptException("the output is too small for the results", ::PyExc_ValueError);
+
+    if (m_type)
+    {
+      double number = value->NumberValue();
+
+      if (try_catch.HasCaught()) CJavascriptException::ThrowIf(isolate, try_catch);
+
+      switch (m_type->format[0])
+      {
+      case 'b': Store(static_cast<int8_t>(v8i::DoubleToInt32(number))); break;
+      case 'B': Store(static_cast<uint8_t>(v8i::DoubleToUint32(number))); break;
+      case 'h': Store(static_cast<int16_t>(v8i::DoubleToInt32(number))); break;
+      case 'H': Store(static_cast<uint16_t>(v8i::DoubleToUint32(number))); break;
+      case 'i': Store(static_cast<int32_t>(v8i::DoubleToInt32(number))); break;
+      case 'I': Store(static_cast<uint32_t>(v8i::DoubleToUint32(number))); break;
+      case 'f': Store(static_cast<float>(number)); break;
+      case 'd': Store(number); break;
+      }
+    }
+    else
+    {
+      py::object item = CJavascriptObject::Wrap(value, isolate);
+
+      if (::PySequence_SetItem(m_out.ptr(), m_count, item.ptr()) < 0) py::throw_error_already_set();
+    }
+
+    m_count++;
+  }
+};
+
+py::object CJavascriptFunction::Batch(py::object iterable, py::object self, bool star, size_t chunk_size, py::object out)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  if (chunk_size == 0) throw CJavascriptException("chunk size should be positive", ::PyExc_ValueError);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+  v8::Handle<v8::Object> receiver = GetReceiver(self);
+
+  if (receiver.IsEmpty()) receiver = m_isolate->GetCurrentContext()->Global();
+
+  py::object iter(py::handle<>(::PyObject_GetIter(iterable.ptr())));
+  py::list results;
+
+  std::auto_ptr<BatchOutput> output(out.is_none() ? NULL : new BatchOutput(out));
+
+  std::vector< v8::Handle<v8::Value> > params, values(chunk_size);
+  std::vector<size_t> offsets;
+
+  for (bool done = false; !done; )
+  {
+    // the handles of a chunk are released together
+    v8::HandleScope chunk_scope(m_isolate);
+
+    params.clear();
+    offsets.clear();
+
+    while (offsets.size() < chunk_size)
+    {
+      PyObject *item = ::PyIter_Next(iter.ptr());
+
+      if (!item)
+      {
+        if (PyErr_OCCURRED()) py::throw_error_already_set();
+
+        done = true;
+        break;
+      }
+
+      py::object obj = py::object(py::handle<>(item));
+
+      offsets.push_back(params.size());
+
+      if (star)
+      {
+        py::object args(py::handle<>(::PySequence_Fast(item, "the arguments should be a sequence")));
+
+        for (Py_ssize_t i=0; i<PySequence_Fast_GET_SIZE(args.ptr()); i++)
+        {
+          params.push_back(CPythonObject::Wrap(py::object(py::handle<>(py::borrowed(PySequence_Fast_GET_ITEM(args.ptr(), i)))), m_isolate));
+        }
+      }
+      else
+      {
+        params.push_back(CPythonObject::Wrap(obj, m_isolate));
+      }
+    }
+
+    size_t count = offsets.size(), called = 0;
+
+    offsets.push_back(params.size());
+
+    // call the function with the whole chunk in one GIL release
+    Py_BEGIN_ALLOW_THREADS
+
+    for (; called < count; called++)
+    {
+      size_t argc = offsets[called+1] - offsets[called];
+
+      values[called] = func->Call(receiver, argc, argc ? &params[offsets[called]] : NULL);
+
+      if (values[called].IsEmpty()) break;
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (called < count) CJavascriptException::ThrowIf(m_isolate, try_catch);
+
+    for (size_t i=0; i<count; i++)
+    {
+      if (output.get())
+      {
+        output->Append(m_isolate, values[i], try_catch);
+      }
+      else
+      {
+        results.append(CJavascriptObject::Wrap(values[i], m_isolate));
+      }
+    }
+  }
+
+  return output.get() ? out : results;
+}
+
+CJavascriptCallSitePtr CJavascriptFunction::Prepare(py::object argtypes, py::object self, py::object restype, bool release_gil)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Handle<v8::Object> receiver = GetReceiver(self);
+
+  return CJavascriptCallSitePtr(new CJavascriptCallSite(m_isolate, v8::Handle<v8::Function>::Cast(Object()),
+                                                        receiver, argtypes, restype, release_gil));
+}
+
+CJavascriptCallSite::CJavascriptCallSite(v8::Isolate *isolate, v8::Handle<v8::Function> func, v8::Handle<v8::Object> self,
+                                         py::object argtypes, py::object restype, bool release_gil)
+  : m_isolate(isolate), m_func(isolate, func), m_restype(CallPlan::ParseKind(restype)), m_releaseGIL(release_gil)
+{
+  if (!self.IsEmpty()) m_self.Reset(isolate, self);
+
+  if (!argtypes.is_none())
+  {
+    for (Py_ssize_t i=0; i<py::len(argtypes); i++)
+    {
+      m_argtypes.push_back(CallPlan::ParseKind(argtypes[i]));
+    }
+  }
+}
+
+py::object CJavascriptCallSite::CallWithArgs(py::tuple args, py::dict kwds)
+{
+  if (::PyTuple_Size(args.ptr()) == 0) throw CJavascriptException("missed self argument", ::PyExc_TypeError);
+
+  py::extract<CJavascriptCallSite&> extractor(args[0]);
+
+  if (!extractor.check()) throw CJavascriptException("missed self argument", ::PyExc_TypeError);
+
+  if (::PyDict_Size(kwds.ptr())) throw CJavascriptException("keyword arguments are not supported", ::PyExc_TypeError);
+
+  return extractor().Call(args, 1);
+}
+
+py::object CJavascriptCallSite::Call(py::tuple args, size_t offset)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::TryCatch try_catch;
+
+  size_t argc = PyTuple_GET_SIZE(args.ptr()) - offset;
+
+  // converting an argument may run Python code which calls the same call site again,
+  // so each call owns its arguments, on the stack if possible
+  v8::Handle<v8::Value> stack_params[kMaxStackArgs];
+  std::vector< v8::Handle<v8::Value> > heap_params;
+
+  if (argc > kMaxStackArgs) heap_params.resize(argc);
+
+  v8::Handle<v8::Value> *params = argc > kMaxStackArgs ? &heap_params[0] : stack_params;
+
+  for (size_t i=0; i<argc; i++)
+  {
+    py::object arg(py::handle<>(py::borrowed(PyTuple_GET_ITEM(args.ptr(), offset + i))));
+
+    params[i] = CallPlan::ToJavascript(i < m_argtypes.size() ? m_argtypes[i] : CallPlan::kObject, arg, m_isolate);
+  }
+
+  v8::Handle<v8::Function> func = v8::Local<v8::Function>::New(m_isolate, m_func);
+  v8::Handle<v8::Object> self = m_self.IsEmpty() ? m_isolate->GetCurrentContext()->Global()
+                                                 : v8::Local<v8::Object>::New(m_isolate, m_self);
+
+  v8::Handle<v8::Value> result;
+
+  if (m_releaseGIL)
+  {
+    Py_BEGIN_ALLOW_THREADS
+
+    result = func->Call(self, argc, params);
+
+    Py_END_ALLOW_THREADS
+  }
+  else
+  {
+    result = func->Call(self, argc, params);
+  }
+
+  if (result.IsEmpty()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+
+  PyObject *value = CallPlan::ToPython(m_restype, result, m_isolate);
+
+  if (!value) py::throw_error_already_set();
+
+  return py::object(py::handle<>(value));
+}
+
+py::object CJavascriptFunction::CreateWithArgs(CJavascriptFunctionPtr proto, py::tuple args, py::dict kwds, CIsolatePtr isolate_)
+{
+  v8::Isolate* isolate = isolate_.get() ? isolate_->GetIsolate() : v8::Isolate::GetCurrent();
+
+  CHECK_V8_CONTEXT(isolate);
+
+  v8::HandleScope handle_scope(isolate);
+
+  if (proto->Object().IsEmpty())
+    throw CJavascriptException("Object prototype may only be an Object", ::PyExc_TypeError);
+
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(proto->Object());
+
+  size_t args_count = ::PyTuple_Size(args.ptr());
+
+  std::vector< v8::Handle<v8::Value> > params(args_count);
+
+  for (size_t i=0; i<args_count; i++)
+  {
+    params[i] = CPythonObject::Wrap(args[i], isolate);
+  }
+
+  v8::Handle<v8::Object> result;
+
+  Py_BEGIN_ALLOW_THREADS
+
+  result = func->NewInstance(params.size(), params.empty() ? NULL : &params[0]);
+
+  Py_END_ALLOW_THREADS
+
+  if (result.IsEmpty()) CJavascriptException::ThrowIf(isolate, try_catch);
+
+  size_t kwds_count = ::PyMapping_Size(kwds.ptr());
+  py::list items = kwds.items();
+
+  for (size_t i=0; i<kwds_count; i++)
+  {
+    py::tuple item(items[i]);
+
+    py::str key(item[0]);
+    py::object value = item[1];
+
+    result->Set(ToString(key, isolate), CPythonObject::Wrap(value, isolate));
+  }
+
+  return CJavascriptObject::Wrap(result, isolate);
+}
+
+py::object CJavascriptFunction::ApplyJavascript(CJavascriptObjectPtr self, py::list args, py::dict kwds)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+  
+  return Call(self->Object(), args, kwds);
+}
+
+py::object CJavascriptFunction::ApplyPython(py::object self, py::list args, py::dict kwds)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  return Call(CPythonObject::Wrap(self, m_isolate)->ToObject(), args, kwds);
+}
+
+py::object CJavascriptFunction::Invoke(py::list args, py::dict kwds)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  return Call(Self(), args, kwds);
+}
+
+const std::string CJavascriptFunction::GetName(void) const
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+
+  v8::String::Utf8Value name(v8::Handle<v8::String>::Cast(func->GetName()));
+
+  return std::string(*name, name.length());
+}
+
+void CJavascriptFunction::SetName(const std::string& name)
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+
+  func->SetName(v8::String::NewFromUtf8(m_isolate, name.c_str(), v8::String::kNormalString, name.size()));
+}
+
+int CJavascriptFunction::GetLineNumber(void) const
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+
+  return func->GetScriptLineNumber();
+}
+int CJavascriptFunction::GetColumnNumber(void) const
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+
+  return func->GetScriptColumnNumber();
+}
+const std::string CJavascriptFunction::GetResourceName(void) const
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+
+  v8::String::Utf8Value name(v8::Handle<v8::String>::Cast(func->GetScriptOrigin().ResourceName()));
+
+  return std::string(*name, name.length());
+}
+const std::string CJavascriptFunction::GetInferredName(void) const
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+
+  v8::String::Utf8Value name(v8::Handle<v8::String>::Cast(func->GetInferredName()));
+
+  return std::string(*name, name.length());
+}
+int CJavascriptFunction::GetLineOffset(void) const
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+
+  return func->GetScriptOrigin().ResourceLineOffset()->Value();
+}
+int CJavascriptFunction::GetColumnOffset(void) const
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+
+  return func->GetScriptOrigin().ResourceColumnOffset()->Value();
+}
+py::object CJavascriptFunction::GetOwner(void) const
+{
+  CHECK_V8_CONTEXT(m_isolate);
+
+  v8::HandleScope handle_scope(m_isolate);
+
+  return CJavascriptObject::Wrap(Self(), m_isolate);
+}
+
+#define CALL_PLAN_CAPSULE_NAME "_PyV8.CallPlan"
+
+CallPlan::CallPlan(py::object callable, py::object signature)
+  : m_callable(callable), m_restype(kObject), m_keywords(AcceptKeywords(callable))
+{
+  py::object argtypes = signature[0];
+
+  for (Py_ssize_t i=0; i<py::len(argtypes); i++)
+  {
+    m_argtypes.push_back(ParseKind(argtypes[i]));
+  }
+
+  m_restype = ParseKind(signature[1]);
+}
+
+void CallPlan::Destructor(PyObject *capsule)
+{
+  delete static_cast<CallPlan *>(::PyCapsule_GetPointer(capsule, CALL_PLAN_CAPSULE_NAME));
+}
+
+CallPlan::Kind CallPlan::ParseKind(py::object spec)
+{
+  py::extract<const std::string> extractor(spec);
+
+  if (!extractor.check()) throw CJavascriptException("the signature type should be a string", ::PyExc_TypeError);
+
+  const std::string name = extractor();
+
+  if (name == "object") return kObject;
+  if (name == "int32") return kInt32;
+  if (name == "uint32") return kUInt32;
+  if (name == "double") return kDouble;
+  if (name == "bool") return kBool;
+  if (name == "str") return kStr;
+  if (name == "bytes") return kBytes;
+
+  throw CJavascriptException("unknown signature type: " + name, ::PyExc_TypeError);
+}
+
+PyObject *CallPlan::ToPython(Kind kind, v8::Handle<v8::Value> value, v8::Isolate *isolate)
+{
+  switch (kind)
+  {
+  case kInt32:
+  #if PY_MAJOR_VERSION < 3
+    return ::PyInt_FromLong(value->Int32Value());
+  #else
+    return ::PyLong_FromLong(value->Int32Value());
+  #endif
+  case kUInt32:
+    return ::PyLong_FromUnsignedLong(value->Uint32Value());
+  case kDouble:
+    return ::PyFloat_FromDouble(value->NumberValue());
+  case kBool:
+    return ::PyBool_FromLong(value->BooleanValue());
+  case kStr:
+  case kBytes:
+  {
+    v8::Handle<v8::String> str = value->ToString();
+
+    if (str.IsEmpty()) str = v8::String::Empty(isolate);
+
+  #if PY_MAJOR_VERSION >= 3
+    if (kind == kStr) return ToPyUnicode(str);
+  #endif
+
+    return ToPyBytes(str);
+  }
+  default:
+    return py::incref(CJavascriptObject::Wrap(value, isolate).ptr());
+  }
+}
+
+double CallPlan::ToNumber(py::object value, v8::Isolate *isolate)
+{
+  if (PyFloat_CheckExact(value.ptr())) return PyFloat_AS_DOUBLE(value.ptr());
+
+  // the strings are parsed by Javascript, since float() accepts the different syntax
+  if (!PyBytes_Check(value.ptr()) && !PyUnicode_Check(value.ptr()))
+  {
+    PyObject *number = ::PyNumber_Float(value.ptr());
+
+    if (number)
+    {
+      double n = PyFloat_AS_DOUBLE(number);
+
+      Py_DECREF(number);
+
+      return n;
+    }
+
+    if (!::PyErr_ExceptionMatches(::PyExc_TypeError)) py::throw_error_already_set();
+
+    ::PyErr_Clear();
+  }
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::Number> number_value = CPythonObject::Wrap(value, isolate)->ToNumber();
+
+  if (number_value.IsEmpty()) CJavascriptException::ThrowIf(isolate, try_catch);
+
+  return number_value->Value();
+}
+
+v8::Handle<v8::Value> CallPlan::ToJavascript(Kind kind, py::object value, v8::Isolate *isolate)
+{
+  if (value.is_none() && kind != kObject) return v8::Undefined(isolate);
+
+  switch (kind)
+  {
+  case kInt32:
+    return v8::Integer::New(isolate, v8i::DoubleToInt32(ToNumber(value, isolate)));
+  case kUInt32:
+    return v8::Integer::NewFromUnsigned(isolate, v8i::DoubleToUint32(ToNumber(value, isolate)));
+  case kDouble:
+    return v8::Number::New(isolate, ToNumber(value, isolate));
+  case kBool:
+  {
+    int b = ::PyObject_IsTrue(value.ptr());
+
+    if (b < 0) py::throw_error_already_set();
+
+    return v8::Boolean::New(isolate, b == 1);
+  }
+  case kStr:
+  case kBytes:
+    return ToString(value, isolate);
+  default:
+    return CPythonObject::Wrap(value, isolate);
+  }
+}
+
+v8::Handle<v8::Value> CallPlan::Invoke(const v8::FunctionCallbackInfo<v8::Value>& info) const
+{
+  v8::Isolate *isolate = info.GetIsolate();
+
+  int argc = info.Length();
+  py::dict kwds;
+  bool has_kwds = false;
+
+  if (m_keywords && argc > 0 && IsKeywordsObject(info[argc-1]))
+  {
+    kwds = PopKeywords(info, argc);
+    has_kwds = true;
+  }
+
+  py::object args(py::handle<>(::PyTuple_New(argc)));
+
+  {
+    v8::TryCatch try_catch;
+
+    for (int i=0; i<argc; i++)
+    {
+      // the extra arguments are converted as the objects
+      PyObject *arg = ToPython(i < (int) m_argtypes.size() ? m_argtypes[i] : kObject, info[i], isolate);
+
+      // valueOf or toString of the argument may throw
+      if (try_catch.HasCaught())
+      {
+        Py_XDECREF(arg);
+
+        try_catch.ReThrow();
+
+        return v8::Undefined(isolate);
+      }
+
+      if (!arg) py::throw_error_already_set();
+
+      PyTuple_SET_ITEM(args.ptr(), i, arg);
+    }
+  }
+
+  py::object result(py::handle<>(::PyObject_Call(m_callable.ptr(), args.ptr(), has_kwds ? kwds.ptr() : NULL)));
+
+  return ToJavascript(m_restype, result, isolate);
+}
+
+py::object CallPlan::CreatePayload(py::object callable)
+{
+  PyObject *func = callable.ptr();
+
+  if (PyMethod_Check(func)) func = PyMethod_GET_FUNCTION(func);
+
+  if (!PyFunction_Check(func)) return callable;
+
+  // look up the function dict directly, to avoid raising AttributeError for the most functions
+  PyObject *dict = reinterpret_cast<PyFunctionObject *>(func)->func_dict;
+  PyObject *signature = dict ? ::PyDict_GetItemString(dict, "__jssignature__") : NULL;
+
+  if (!signature) return callable;
+
+  std::auto_ptr<CallPlan> plan(new CallPlan(callable, py::object(py::handle<>(py::borrowed(signature)))));
+
+  py::object payload(py::handle<>(::PyCapsule_New(plan.get(), CALL_PLAN_CAPSULE_NAME, Destructor)));
+
+  plan.release();
+
+  return payload;
+}
+
+const CallPlan *CallPlan::FromPayload(py::object payload)
+{
+  if (!PyCapsule_CheckExact(payload.ptr())) return NULL;
+
+  void *plan = ::PyCapsule_GetPointer(payload.ptr(), CALL_PLAN_CAPSULE_NAME);
+
+  if (!plan) ::PyErr_Clear();
+
+  return static_cast<const CallPlan *>(plan);
+}
+
+//
+// Hold the payload of a cached template until its data is collected by V8
+//
+class FunctionTemplateCache::Payload
+{
+  py::object m_payload;
+  v8::Persistent<v8::External> m_data;
+
+  static void WeakCallback(const v8::WeakCallbackData<v8::External, Payload>& data)
+  {
+    Payload *payload = data.GetParameter();
+
+    FunctionTemplateCache *cache = GetCache(data.GetIsolate(), false);
+
+    if (cache) cache->m_payloads.erase(payload);
+
+    CPythonGIL python_gil;
+
+    delete payload;
+  }
+public:
+  Payload(py::object payload) : m_payload(payload)
+  {
+  }
+
+  ~Payload(void)
+  {
+    m_data.Reset();
+  }
+
+  v8::Local<v8::External> Trace(v8::Isolate *isolate)
   {
-    array = v8::Array::New(m_isolate);
+    v8::Local<v8::External> data = v8::External::New(isolate, &m_payload);
 
-    py::object iter(py::handle<>(::PyObject_GetIter(m_items.ptr())));
+    m_data.Reset(isolate, data);
+    m_data.SetWeak(this, WeakCallback);
 
-    m_size = 0;
-    PyObject *item = NULL;
+    return data;
+  }
+};
 
-    while (NULL != (item = ::PyIter_Next(iter.ptr())))
-    {
-      array->Set(v8::Uint32::New(m_isolate, m_size++), CPythonObject::Wrap(py::object(py::handle<>(py::borrowed(item))), m_isolate));
-    }
+FunctionTemplateCache::~FunctionTemplateCache(void)
+{
+  for (EntryList::iterator it = m_lru.begin(); it != m_lru.end(); it++)
+  {
+    (*it)->tmpl.Reset();
+
+    delete *it;
   }
 
-  m_obj.Reset(m_isolate, array);
+  for (std::set<Payload *>::iterator it = m_payloads.begin(); it != m_payloads.end(); it++)
+  {
+    delete *it;
+  }
 }
-size_t CJavascriptArray::Length(void)
+
+void FunctionTemplateCache::WeakCallback(const v8::WeakCallbackData<v8::FunctionTemplate, Entry>& data)
 {
-  CHECK_V8_CONTEXT(m_isolate);
+  // the contexts which instantiated the template are gone, the entry will be replaced when it is found again
+  data.GetParameter()->tmpl.Reset();
+}
 
-  LazyConstructor();
+void FunctionTemplateCache::Evict(EntryMap::iterator it)
+{
+  std::auto_ptr<Entry> entry(*it->second);
 
-  v8::HandleScope handle_scope(m_isolate);
+  entry->tmpl.Reset();
 
-  return v8::Handle<v8::Array>::Cast(Object())->Length();
+  m_lru.erase(it->second);
+  m_entries.erase(it);
 }
-py::object CJavascriptArray::GetItem(py::object key)
+
+bool FunctionTemplateCache::IsStable(py::object callable)
 {
-#ifdef SUPPORT_PROBES
-  if (WRAPPER_JS_ARRAY_GETITEM_ENABLED()) {
-    WRAPPER_JS_ARRAY_GETITEM(&m_obj, key.ptr());
+  PyObject *obj = callable.ptr();
+
+  if (PyType_Check(obj)) return true;
+
+  if (PyCFunction_Check(obj))
+  {
+    PyObject *self = PyCFunction_GET_SELF(obj);
+
+    return !self || PyModule_Check(self);
   }
-#endif
 
-  CHECK_V8_CONTEXT(m_isolate);
+  if (PyFunction_Check(obj))
+  {
+    // only the function bound to a name of its module
+    PyObject *name = reinterpret_cast<PyFunctionObject *>(obj)->func_name;
 
-  LazyConstructor();
+    return PyDict_GetItem(PyFunction_GET_GLOBALS(obj), name) == obj;
+  }
 
-  v8::HandleScope handle_scope(m_isolate);
+  return false;
+}
 
-  v8::TryCatch try_catch;
+v8::Handle<v8::FunctionTemplate> FunctionTemplateCache::Get(v8::Isolate *isolate, py::object callable)
+{
+  EntryMap::iterator it = m_entries.find(callable.ptr());
 
-  if (PySlice_Check(key.ptr()))
+  if (it != m_entries.end())
   {
-    Py_ssize_t arrayLen = v8::Handle<v8::Array>::Cast(Object())->Length();
-    Py_ssize_t start, stop, step, sliceLen;
+    Entry *entry = *it->second;
 
-    if (0 == ::PySlice_GetIndicesEx(PySlice_Cast(key.ptr()), arrayLen, &start, &stop, &step, &sliceLen))
+    PyObject *key = PyWeakref_CheckRef(entry->key.ptr()) ? PyWeakref_GET_OBJECT(entry->key.ptr()) : entry->key.ptr();
+
+    if (key == callable.ptr() && !entry->tmpl.IsEmpty())
     {
-      py::list slice;
+      m_lru.splice(m_lru.begin(), m_lru, it->second);
 
-      for (Py_ssize_t idx=start; idx<stop; idx+=step)
-      {
-        v8::Handle<v8::Value> value = Object()->Get(v8::Integer::New(m_isolate, (uint32_t) idx));
+      return v8::Local<v8::FunctionTemplate>::New(isolate, entry->tmpl);
+    }
 
-        if (value.IsEmpty()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+    // the callable was collected and its address is reused, or the template was collected with the contexts
+    Evict(it);
+  }
 
-        slice.append(CJavascriptObject::Wrap(value, m_isolate, Object()));
-      }
+  if (!IsStable(callable)) return v8::Handle<v8::FunctionTemplate>();
 
-      return slice;
-    }
+  std::auto_ptr<Entry> entry(new Entry());
+
+  entry->callable = callable.ptr();
+
+  if (PyType_SUPPORTS_WEAKREFS(Py_TYPE(callable.ptr())))
+  {
+    entry->key = py::object(py::handle<>(::PyWeakref_NewRef(callable.ptr(), NULL)));
   }
-  else if (PyInt_Check(key.ptr()) || PyLong_Check(key.ptr()))
+  else
   {
-    uint32_t idx = PyInt_Check(key.ptr()) ? (uint32_t) ::PyInt_AsUnsignedLongMask(key.ptr()) : (uint32_t) ::PyLong_AsUnsignedLong(key.ptr());
+    entry->key = callable;
+  }
 
-    if (!Object()->Has(idx)) return py::object();
+  std::auto_ptr<Payload> payload(new Payload(CallPlan::CreatePayload(callable)));
 
-    v8::Handle<v8::Value> value = Object()->Get(v8::Integer::New(m_isolate, idx));
+  v8::Local<v8::FunctionTemplate> func_tmpl = v8::FunctionTemplate::New(isolate, CPythonObject::Caller, payload->Trace(isolate));
 
-    if (value.IsEmpty()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+  m_payloads.insert(payload.release());
 
-    return CJavascriptObject::Wrap(value, m_isolate, Object());
+  if (PyType_Check(callable.ptr()))
+  {
+    func_tmpl->SetClassName(v8::String::NewFromUtf8(isolate, py::extract<const char *>(callable.attr("__name__"))()));
   }
 
-  throw CJavascriptException("list indices must be integers", ::PyExc_TypeError);
-}
-
-py::object CJavascriptArray::SetItem(py::object key, py::object value)
-{
-#ifdef SUPPORT_PROBES
-  if (WRAPPER_JS_ARRAY_SETITEM_ENABLED()) {
-    WRAPPER_JS_ARRAY_SETITEM(&m_obj, key.ptr(), value.ptr());
-  }
-#endif
+  entry->tmpl.Reset(isolate, func_tmpl);
+  entry->tmpl.SetWeak(entry.get(), WeakCallback);
 
-  CHECK_V8_CONTEXT(m_isolate);
+  if (m_entries.size() >= kMaxEntries) Evict(m_entries.find(m_lru.back()->callable));
 
-  LazyConstructor();
+  m_lru.push_front(entry.release());
+  m_entries[callable.ptr()] = m_lru.begin();
 
-  v8::HandleScope handle_scope(m_isolate);
+  return func_tmpl;
+}
 
-  v8::TryCatch try_catch;
+FunctionTemplateCache *FunctionTemplateCache::GetCache(v8::Isolate *isolate, bool create)
+{
+  FunctionTemplateCache *cache = static_cast<FunctionTemplateCache *>(isolate->GetData(kFunctionTemplateSlot));
 
-  if (PySlice_Check(key.ptr()))
+  if (!cache && create)
   {
-    PyObject *values = ::PySequence_Fast(value.ptr(), "can only assign an iterable");
+    cache = new FunctionTemplateCache();
 
-    if (values)
-    {
-      Py_ssize_t itemSize = PySequence_Fast_GET_SIZE(value.ptr());
-      PyObject **items = PySequence_Fast_ITEMS(value.ptr());
+    isolate->SetData(kFunctionTemplateSlot, cache);
+  }
 
-      Py_ssize_t arrayLen = v8::Handle<v8::Array>::Cast(Object())->Length();
-      Py_ssize_t start, stop, step, sliceLen;
+  return cache;
+}
 
-      if (0 == ::PySlice_GetIndicesEx(PySlice_Cast(key.ptr()), arrayLen, &start, &stop, &step, &sliceLen))
-      {
-        if (itemSize != sliceLen)
-        {
-          v8i::Handle<v8i::JSArray> array = v8::Utils::OpenHandle(*Object());
-
-          array->set_length(v8i::Smi::FromInt(arrayLen - sliceLen + itemSize));
-
-          if (itemSize < sliceLen)
-          {
-            Py_ssize_t diff = sliceLen - itemSize;
-
-            for (Py_ssize_t idx=start+itemSize; idx<arrayLen-diff; idx++)
-            {
-              Object()->Set(idx, Object()->Get((uint32_t) (idx + diff)));
-            }
-            for (Py_ssize_t idx=arrayLen-1; idx >arrayLen-diff-1; idx--)
-            {
-              Object()->Delete((uint32_t) idx);
-            }
-          }
-          else if (itemSize > sliceLen)
-          {
-            Py_ssize_t diff = itemSize - sliceLen;
-
-            for (Py_ssize_t idx=arrayLen+diff-1; idx>stop-1; idx--)
-            {
-              Object()->Set(idx, Object()->Get((uint32_t) (idx - diff)));
-            }
-          }
-        }
+void FunctionTemplateCache::Dispose(v8::Isolate *isolate)
+{
+  std::auto_ptr<FunctionTemplateCache> cache(GetCache(isolate, false));
 
-        for (Py_ssize_t idx=0; idx<itemSize; idx++)
-        {
-          Object()->Set((uint32_t) (start + idx), CPythonObject::Wrap(py::object(py::handle<>(py::borrowed(items[idx]))), m_isolate));
-        }
-      }
-    }
-  }
-  else if (PyInt_Check(key.ptr()) || PyLong_Check(key.ptr()))
+  isolate->SetData(kFunctionTemplateSlot, NULL);
+}
+
+PropertyNameCache::~PropertyNameCache(void)
+{
+  for (EntryList::iterator it = m_lru.begin(); it != m_lru.end(); it++)
   {
-    uint32_t idx = PyInt_Check(key.ptr()) ? (uint32_t) ::PyInt_AsUnsignedLongMask(key.ptr()) : (uint32_t) ::PyLong_AsUnsignedLong(key.ptr());
+    (*it)->value.Reset();
 
-    if (!Object()->Set(v8::Integer::New(m_isolate, idx), CPythonObject::Wrap(value, m_isolate)))
-      CJavascriptException::ThrowIf(m_isolate, try_catch);
+    delete *it;
   }
-
-  return value;
 }
-py::object CJavascriptArray::DelItem(py::object key)
+
+v8::Handle<v8::String> PropertyNameCache::Get(v8::Isolate *isolate, py::object name)
 {
-#ifdef SUPPORT_PROBES
-  if (WRAPPER_JS_ARRAY_DELITEM_ENABLED()) {
-    WRAPPER_JS_ARRAY_DELITEM(&m_obj, key.ptr());
+  EntryMap::iterator it = m_entries.find(name.ptr());
+
+  if (it != m_entries.end())
+  {
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+
+    return v8::Local<v8::String>::New(isolate, (*it->second)->value);
   }
-#endif
 
-  CHECK_V8_CONTEXT(m_isolate);
+#if PY_MAJOR_VERSION >= 3
+  Py_ssize_t len = 0;
+  const char *data = ::PyUnicode_AsUTF8AndSize(name.ptr(), &len);
 
-  LazyConstructor();
+  if (!data) py::throw_error_already_set();
+#else
+  Py_ssize_t len = PyString_GET_SIZE(name.ptr());
+  const char *data = PyString_AS_STRING(name.ptr());
+#endif
 
-  v8::HandleScope handle_scope(m_isolate);
+  v8::Local<v8::String> value = v8::String::NewFromUtf8(isolate, data, v8::String::kInternalizedString, len);
 
-  v8::TryCatch try_catch;
+  std::auto_ptr<Entry> entry;
 
-  if (PySlice_Check(key.ptr()))
+  if (m_entries.size() >= kMaxEntries)
   {
-    Py_ssize_t arrayLen = v8::Handle<v8::Array>::Cast(Object())->Length();
-    Py_ssize_t start, stop, step, sliceLen;
+    // reuse the least recently used entry
+    entry.reset(m_lru.back());
 
-    if (0 == ::PySlice_GetIndicesEx(PySlice_Cast(key.ptr()), arrayLen, &start, &stop, &step, &sliceLen))
-    {
-      for (Py_ssize_t idx=stop; idx<arrayLen; idx++)
-      {
-        Object()->Set((uint32_t) (idx - sliceLen), Object()->Get((uint32_t) idx));
-      }
+    m_entries.erase(entry->name.ptr());
+    m_lru.pop_back();
+  }
+  else
+  {
+    entry.reset(new Entry());
+  }
 
-      for (Py_ssize_t idx=arrayLen-1; idx>arrayLen-sliceLen-1; idx--)
-      {
-        Object()->Delete((uint32_t)idx);
-      }
+  entry->name = name;
+  entry->value.Reset(isolate, value);
 
-      v8i::Handle<v8i::JSArray> array = v8::Utils::OpenHandle(*Object());
+  m_lru.push_front(entry.release());
+  m_entries.insert(std::make_pair(name.ptr(), m_lru.begin()));
 
-      array->set_length(v8i::Smi::FromInt(arrayLen - sliceLen));
-    }
+  return value;
+}
 
-    return py::object();
-  }
-  else if (PyInt_Check(key.ptr()) || PyLong_Check(key.ptr()))
-  {
-    uint32_t idx = PyInt_Check(key.ptr()) ? (uint32_t) ::PyInt_AsUnsignedLongMask(key.ptr()) : (uint32_t) ::PyLong_AsUnsignedLong(key.ptr());
+PropertyNameCache *PropertyNameCache::GetCache(v8::Isolate *isolate, bool create)
+{
+  PropertyNameCache *cache = static_cast<PropertyNameCache *>(isolate->GetData(kPropertyNameSlot));
 
-    py::object value;
+  if (!cache && create)
+  {
+    cache = new PropertyNameCache();
 
-    if (Object()->Has(idx))
-      value = CJavascriptObject::Wrap(Object()->Get(v8::Integer::New(m_isolate, idx)), m_isolate, Object());
+    isolate->SetData(kPropertyNameSlot, cache);
+  }
 
-    if (!Object()->Delete(idx))
-      CJavascriptException::ThrowIf(m_isolate, try_catch);
+  return cache;
+}
 
-    return value;
-  }
+void PropertyNameCache::Dispose(v8::Isolate *isolate)
+{
+  std::auto_ptr<PropertyNameCache> cache(GetCache(isolate, false));
 
-  throw CJavascriptException("list indices must be integers", ::PyExc_TypeError);
+  isolate->SetData(kPropertyNameSlot, NULL);
 }
 
-bool CJavascriptArray::Contains(py::object item)
+v8::Handle<v8::String> PropertyNameCache::ToPropertyName(v8::Isolate *isolate, py::object name)
 {
-  CHECK_V8_CONTEXT(m_isolate);
+#if PY_MAJOR_VERSION >= 3
+  if (PyUnicode_CheckExact(name.ptr()) && PyUnicode_CHECK_INTERNED(name.ptr()))
+#else
+  if (PyString_CheckExact(name.ptr()) && PyString_CHECK_INTERNED(name.ptr()))
+#endif
+  {
+    return GetCache(isolate, true)->Get(isolate, name);
+  }
 
-  LazyConstructor();
+  if (PyBytes_Check(name.ptr()))
+  {
+    return DecodeUtf8(std::string(PyBytes_AS_STRING(name.ptr()), PyBytes_GET_SIZE(name.ptr())), isolate);
+  }
 
-  v8::HandleScope handle_scope(m_isolate);
+  if (PyUnicode_Check(name.ptr())) return ToString(name, isolate);
 
-  v8::TryCatch try_catch;
+  throw CJavascriptException("attribute name must be string", ::PyExc_TypeError);
+}
 
-  for (size_t i=0; i<Length(); i++)
+ConvertHookCache::~ConvertHookCache(void)
+{
+  for (EntryList::iterator it = m_lru.begin(); it != m_lru.end(); it++)
   {
-    if (Object()->Has(i))
-    {
-      v8::Handle<v8::Value> value = Object()->Get(v8::Integer::New(m_isolate, i));
+    delete *it;
+  }
+}
 
-      if (try_catch.HasCaught()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+void ConvertHookCache::Lookup(Entry *entry)
+{
+  entry->method = py::object();
+  entry->converter = NULL;
 
-      if (item == CJavascriptObject::Wrap(value, m_isolate, Object()))
-      {
-        return true;
-      }
-    }
+  PyObject *hook = ::PyObject_GetAttrString(entry->type.ptr(), "__js__");
+
+  if (!hook)
+  {
+    ::PyErr_Clear();
   }
+  else if (PyCapsule_IsValid(hook, JS_CONVERTER_CAPSULE))
+  {
+    entry->converter = reinterpret_cast<JSConverter>(::PyCapsule_GetPointer(hook, JS_CONVERTER_CAPSULE));
 
-  if (try_catch.HasCaught()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+    Py_DECREF(hook);
+  }
+  else if (::PyCallable_Check(hook))
+  {
+    entry->method = py::object(py::handle<>(hook));
+  }
+  else
+  {
+    Py_DECREF(hook);
+  }
 
-  return false;
+  // the attribute lookup assigns a version tag, which will be invalidated when the type is modified
+  entry->version = reinterpret_cast<PyTypeObject *>(entry->type.ptr())->tp_version_tag;
 }
 
-py::object CJavascriptFunction::CallWithArgs(py::tuple args, py::dict kwds)
+bool ConvertHookCache::Convert(py::object obj, py::object& result)
 {
-  size_t argc = ::PyTuple_Size(args.ptr());
+  PyTypeObject *type = Py_TYPE(obj.ptr());
 
-  if (argc == 0) throw CJavascriptException("missed self argument", ::PyExc_TypeError);
+  EntryMap::iterator it = m_entries.find(type);
 
-  py::object self = args[0];
-  py::extract<CJavascriptFunction&> extractor(self);
+  Entry *entry = NULL;
 
-  if (!extractor.check()) throw CJavascriptException("missed self argument", ::PyExc_TypeError);
+  if (it != m_entries.end())
+  {
+    entry = *it->second;
 
-  CJavascriptFunction& func = extractor();
-  
-  CHECK_V8_CONTEXT(func.m_isolate);
-  
-  v8::HandleScope handle_scope(func.m_isolate);
-  v8::TryCatch try_catch;
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
 
-  py::list argv(args.slice(1, py::_));
+    if (!PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG) || type->tp_version_tag != entry->version) Lookup(entry);
+  }
+  else
+  {
+    if (m_entries.size() >= kMaxEntries)
+    {
+      std::auto_ptr<Entry> last(m_lru.back());
 
-  return func.Call(func.Self(), argv, kwds);
-}
+      m_entries.erase(reinterpret_cast<PyTypeObject *>(last->type.ptr()));
+      m_lru.pop_back();
+    }
 
-py::object CJavascriptFunction::Call(v8::Handle<v8::Object> self, py::list args, py::dict kwds)
-{
-  CHECK_V8_CONTEXT(m_isolate);
+    std::auto_ptr<Entry> created(new Entry());
 
-  v8::HandleScope handle_scope(m_isolate);
+    created->type = py::object(py::handle<>(py::borrowed(reinterpret_cast<PyObject *>(type))));
 
-  v8::TryCatch try_catch;
+    Lookup(created.get());
 
-  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+    m_lru.push_front(entry = created.release());
+    m_entries[type] = m_lru.begin();
+  }
 
-  size_t args_count = ::PyList_Size(args.ptr()), kwds_count = ::PyMapping_Size(kwds.ptr());
+  // the hook may convert other objects and evict the entry
+  JSConverter converter = entry->converter;
+  py::object method = entry->method;
 
-  std::vector< v8::Handle<v8::Value> > params(args_count + kwds_count);
+  PyObject *value = NULL;
 
-  for (size_t i=0; i<args_count; i++)
+  if (converter)
   {
-    params[i] = CPythonObject::Wrap(args[i], m_isolate);
+    value = converter(obj.ptr());
   }
-
-  py::list values = kwds.values();
-
-  for (size_t i=0; i<kwds_count; i++)
+  else if (!method.is_none())
   {
-    params[args_count+i] = CPythonObject::Wrap(values[i], m_isolate);
+    value = ::PyObject_CallFunctionObjArgs(method.ptr(), obj.ptr(), NULL);
+  }
+  else
+  {
+    return false;
   }
 
-  v8::Handle<v8::Value> result;
+  if (!value) py::throw_error_already_set();
 
-  Py_BEGIN_ALLOW_THREADS
+  result = py::object(py::handle<>(value));
 
-  result = func->Call(
-    self.IsEmpty() ? m_isolate->GetCurrentContext()->Global() : self,
-    params.size(), params.empty() ? NULL : &params[0]);
+  if (Py_TYPE(value) == type)
+    throw CJavascriptException("__js__ should return a value of another type", ::PyExc_TypeError);
 
-  Py_END_ALLOW_THREADS
+  return true;
+}
 
-  if (result.IsEmpty()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+ConvertHookCache *ConvertHookCache::GetCache(v8::Isolate *isolate, bool create)
+{
+  ConvertHookCache *cache = static_cast<ConvertHookCache *>(isolate->GetData(kConvertHookSlot));
 
-  return CJavascriptObject::Wrap(result, m_isolate);
+  if (!cache && create)
+  {
+    cache = new ConvertHookCache();
+
+    isolate->SetData(kConvertHookSlot, cache);
+  }
+
+  return cache;
 }
 
-py::object CJavascriptFunction::CreateWithArgs(CJavascriptFunctionPtr proto, py::tuple args, py::dict kwds, CIsolatePtr isolate_)
+void ConvertHookCache::Dispose(v8::Isolate *isolate)
 {
-  v8::Isolate* isolate = isolate_.get() ? isolate_->GetIsolate() : v8::Isolate::GetCurrent();
+  std::auto_ptr<ConvertHookCache> cache(GetCache(isolate, false));
 
-  CHECK_V8_CONTEXT(isolate);
+  isolate->SetData(kConvertHookSlot, NULL);
+}
 
-  v8::HandleScope handle_scope(isolate);
+#ifdef SUPPORT_TYPE_TEMPLATE
 
-  if (proto->Object().IsEmpty())
-    throw CJavascriptException("Object prototype may only be an Object", ::PyExc_TypeError);
+TypeTemplateCache::~TypeTemplateCache(void)
+{
+  for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); it++)
+  {
+    it->second->tmpl.Reset();
+
+    delete it->second;
+  }
+}
 
-  v8::TryCatch try_catch;
+v8::Handle<v8::ObjectTemplate> TypeTemplateCache::Get(v8::Isolate *isolate, py::object obj)
+{
+  PyTypeObject *type = Py_TYPE(obj.ptr());
 
-  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(proto->Object());
+  EntryMap::const_iterator it = m_entries.find(type);
 
-  size_t args_count = ::PyTuple_Size(args.ptr());
+  if (it != m_entries.end()) return v8::Local<v8::ObjectTemplate>::New(isolate, it->second->tmpl);
 
-  std::vector< v8::Handle<v8::Value> > params(args_count);
+  TypeMap::iterator unmarked = m_unmarked.find(type);
 
-  for (size_t i=0; i<args_count; i++)
+  if (unmarked != m_unmarked.end())
   {
-    params[i] = CPythonObject::Wrap(args[i], isolate);
-  }
+    m_lru.splice(m_lru.begin(), m_lru, unmarked->second);
 
-  v8::Handle<v8::Object> result;
+    return v8::Handle<v8::ObjectTemplate>();
+  }
 
-  Py_BEGIN_ALLOW_THREADS
+  py::object cls(py::handle<>(py::borrowed(reinterpret_cast<PyObject *>(type))));
 
-  result = func->NewInstance(params.size(), params.empty() ? NULL : &params[0]);
+  PyObject *mark = ::PyObject_GetAttrString(cls.ptr(), "__jstemplate__");
 
-  Py_END_ALLOW_THREADS
+  if (!mark) ::PyErr_Clear();
 
-  if (result.IsEmpty()) CJavascriptException::ThrowIf(isolate, try_catch);
+  bool marked = mark && ::PyObject_IsTrue(mark) == 1;
 
-  size_t kwds_count = ::PyMapping_Size(kwds.ptr());
-  py::list items = kwds.items();
+  Py_XDECREF(mark);
 
-  for (size_t i=0; i<kwds_count; i++)
+  if (!marked)
   {
-    py::tuple item(items[i]);
+    if (m_lru.size() >= kMaxUnmarked)
+    {
+      m_unmarked.erase(reinterpret_cast<PyTypeObject *>(m_lru.back().ptr()));
+      m_lru.pop_back();
+    }
 
-    py::str key(item[0]);
-    py::object value = item[1];
+    m_lru.push_front(cls);
+    m_unmarked[type] = m_lru.begin();
 
-    result->Set(ToString(key, isolate), CPythonObject::Wrap(value, isolate));
+    return v8::Handle<v8::ObjectTemplate>();
   }
 
-  return CJavascriptObject::Wrap(result, isolate);
-}
+  std::auto_ptr<Entry> entry(new Entry());
 
-py::object CJavascriptFunction::ApplyJavascript(CJavascriptObjectPtr self, py::list args, py::dict kwds)
-{
-  CHECK_V8_CONTEXT(m_isolate);
+  entry->type = cls;
+  entry->tmpl.Reset(isolate, CPythonObject::CreateTypeTemplate(isolate, entry->type, entry->names, entry->declared));
 
-  v8::HandleScope handle_scope(m_isolate);
-  
-  return Call(self->Object(), args, kwds);
+  it = m_entries.insert(std::make_pair(type, entry.release())).first;
+
+  return v8::Local<v8::ObjectTemplate>::New(isolate, it->second->tmpl);
 }
 
-py::object CJavascriptFunction::ApplyPython(py::object self, py::list args, py::dict kwds)
+TypeTemplateCache *TypeTemplateCache::GetCache(v8::Isolate *isolate, bool create)
 {
-  CHECK_V8_CONTEXT(m_isolate);
+  TypeTemplateCache *cache = static_cast<TypeTemplateCache *>(isolate->GetData(kTypeTemplateSlot));
 
-  v8::HandleScope handle_scope(m_isolate);
+  if (!cache && create)
+  {
+    cache = new TypeTemplateCache();
 
-  return Call(CPythonObject::Wrap(self, m_isolate)->ToObject(), args, kwds);
+    isolate->SetData(kTypeTemplateSlot, cache);
+  }
+
+  return cache;
 }
 
-py::object CJavascriptFunction::Invoke(py::list args, py::dict kwds)
+void TypeTemplateCache::Dispose(v8::Isolate *isolate)
 {
-  CHECK_V8_CONTEXT(m_isolate);
-
-  v8::HandleScope handle_scope(m_isolate);
+  std::auto_ptr<TypeTemplateCache> cache(GetCache(isolate, false));
 
-  return Call(Self(), args, kwds);
+  isolate->SetData(kTypeTemplateSlot, NULL);
 }
 
-const std::string CJavascriptFunction::GetName(void) const
-{
-  CHECK_V8_CONTEXT(m_isolate);
+#endif // SUPPORT_TYPE_TEMPLATE
 
-  v8::HandleScope handle_scope(m_isolate);
+#ifdef SUPPORT_WRAPPER_CACHE
 
-  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+WrapperCache::WrapperCache(v8::Handle<v8::Context> ctxt)
+  : m_ctxt(v8::Isolate::GetCurrent(), ctxt), m_sweepSize(64)
+{
+  m_ctxt.SetWeak(this, WeakCallback);
+}
 
-  v8::String::Utf8Value name(v8::Handle<v8::String>::Cast(func->GetName()));
+WrapperCache::~WrapperCache(void)
+{
+  m_ctxt.Reset();
 
-  return std::string(*name, name.length());
+  CPythonGIL python_gil;
+
+  for (EntryMap::const_iterator it = m_entries.begin(); it != m_entries.end(); it++)
+  {
+    Py_DECREF(it->second.ref);
+  }
 }
 
-void CJavascriptFunction::SetName(const std::string& name)
+void WrapperCache::WeakCallback(const v8::WeakCallbackData<v8::Context, WrapperCache>& data)
 {
-  CHECK_V8_CONTEXT(m_isolate);
-
-  v8::HandleScope handle_scope(m_isolate);
+  WrapperCache *cache = data.GetParameter();
 
-  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+  cache->m_ctxt.Reset();
 
-  func->SetName(v8::String::NewFromUtf8(m_isolate, name.c_str(), v8::String::kNormalString, name.size()));
+  delete cache;
 }
 
-int CJavascriptFunction::GetLineNumber(void) const
+WrapperCache *WrapperCache::GetCache(v8::Isolate *isolate)
 {
-  CHECK_V8_CONTEXT(m_isolate);
+  if (!isolate->InContext()) return NULL;
 
-  v8::HandleScope handle_scope(m_isolate);
+  v8::HandleScope handle_scope(isolate);
 
-  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+  v8::Handle<v8::Context> ctxt = isolate->GetCurrentContext();
 
-  return func->GetScriptLineNumber();
-}
-int CJavascriptFunction::GetColumnNumber(void) const
-{
-  CHECK_V8_CONTEXT(m_isolate);
+  v8::Handle<v8::Value> value = ctxt->GetEmbedderData(kWrapperCacheSlot);
 
-  v8::HandleScope handle_scope(m_isolate);
+  if (!value.IsEmpty() && value->IsExternal())
+  {
+    return static_cast<WrapperCache *>(v8::Handle<v8::External>::Cast(value)->Value());
+  }
 
-  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+  WrapperCache *cache = new WrapperCache(ctxt);
 
-  return func->GetScriptColumnNumber();
+  ctxt->SetEmbedderData(kWrapperCacheSlot, v8::External::New(isolate, cache));
+
+  return cache;
 }
-const std::string CJavascriptFunction::GetResourceName(void) const
+
+py::object WrapperCache::Find(int hash, v8::Handle<v8::Object> obj, v8::Handle<v8::Object> self)
 {
-  CHECK_V8_CONTEXT(m_isolate);
+  CPythonGIL python_gil;
 
-  v8::HandleScope handle_scope(m_isolate);
+  std::pair<EntryMap::iterator, EntryMap::iterator> range = m_entries.equal_range(hash);
 
-  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+  for (EntryMap::iterator it = range.first; it != range.second;)
+  {
+    PyObject *wrapper = PyWeakref_GET_OBJECT(it->second.ref);
 
-  v8::String::Utf8Value name(v8::Handle<v8::String>::Cast(func->GetScriptOrigin().ResourceName()));
+    if (wrapper == Py_None)
+    {
+      Py_DECREF(it->second.ref);
 
-  return std::string(*name, name.length());
-}
-const std::string CJavascriptFunction::GetInferredName(void) const
-{
-  CHECK_V8_CONTEXT(m_isolate);
+      m_entries.erase(it++);
 
-  v8::HandleScope handle_scope(m_isolate);
+      continue;
+    }
 
-  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+    if (it->second.obj->Object() == obj)
+    {
+      CJavascriptFunction *func = dynamic_cast<CJavascriptFunction *>(it->second.obj);
 
-  v8::String::Utf8Value name(v8::Handle<v8::String>::Cast(func->GetInferredName()));
+      // the function wrapper is bound to its owner
+      if (!func || func->Self() == self)
+      {
+        return py::object(py::handle<>(py::borrowed(wrapper)));
+      }
+    }
 
-  return std::string(*name, name.length());
+    it++;
+  }
+
+  return py::object();
 }
-int CJavascriptFunction::GetLineOffset(void) const
+
+void WrapperCache::Insert(int hash, py::object wrapper, CJavascriptObject *obj)
 {
-  CHECK_V8_CONTEXT(m_isolate);
+  CPythonGIL python_gil;
 
-  v8::HandleScope handle_scope(m_isolate);
+  PyObject *ref = ::PyWeakref_NewRef(wrapper.ptr(), NULL);
 
-  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+  if (!ref)
+  {
+    ::PyErr_Clear();
 
-  return func->GetScriptOrigin().ResourceLineOffset()->Value();
-}
-int CJavascriptFunction::GetColumnOffset(void) const
-{
-  CHECK_V8_CONTEXT(m_isolate);
+    return;
+  }
 
-  v8::HandleScope handle_scope(m_isolate);
+  Entry entry = { ref, obj };
 
-  v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+  m_entries.insert(std::make_pair(hash, entry));
 
-  return func->GetScriptOrigin().ResourceColumnOffset()->Value();
+  if (m_entries.size() >= m_sweepSize) Sweep();
 }
-py::object CJavascriptFunction::GetOwner(void) const
+
+void WrapperCache::Sweep(void)
 {
-  CHECK_V8_CONTEXT(m_isolate);
+  for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end();)
+  {
+    if (PyWeakref_GET_OBJECT(it->second.ref) == Py_None)
+    {
+      Py_DECREF(it->second.ref);
 
-  v8::HandleScope handle_scope(m_isolate);
+      m_entries.erase(it++);
+    }
+    else
+    {
+      it++;
+    }
+  }
 
-  return CJavascriptObject::Wrap(Self(), m_isolate);
+  // amortize the sweeping cost with the living wrappers
+  m_sweepSize = std::max<size_t>(64, m_entries.size() * 2);
 }
 
+#endif // SUPPORT_WRAPPER_CACHE
+
 #ifdef SUPPORT_TRACE_LIFECYCLE
 
-ObjectTracer::ObjectTracer(v8::Handle<v8::Value> handle, py::object *object)
-  : m_handle(v8::Isolate::GetCurrent(), handle),
-    m_object(object), m_living(GetLivingMapping())
+ObjectTracer::ObjectTracer(py::object object, PyObject *key, LivingMap *living)
+  : m_object(object), m_key(key ? key : object.ptr()), m_living(living), m_prev(NULL), m_next(NULL)
 {
+  m_living->Link(this);
 }
 
 ObjectTracer::~ObjectTracer()
@@ -1877,57 +4713,94 @@ ObjectTracer::~ObjectTracer()
 
     Dispose();
 
-    m_living->erase(m_object->ptr());
+    m_living->Erase(m_key, this);
   }
+
+  m_living->Unlink(this);
 }
 
 void ObjectTracer::Dispose(void)
 {
+  if (m_handle.IsEmpty()) return;
+
   m_handle.ClearWeak();
   m_handle.Reset();
 }
 
-ObjectTracer& ObjectTracer::Trace(v8::Handle<v8::Value> handle, py::object *object)
+void ObjectTracer::Release(void)
 {
-  std::auto_ptr<ObjectTracer> tracer(new ObjectTracer(handle, object));
+  LivingMap *living = m_living;
 
-  tracer->Trace();
+  this->~ObjectTracer();
+
+  living->Pool().Release(this);
+}
+
+ObjectTracer& ObjectTracer::Allocate(py::object object, PyObject *key)
+{
+  LivingMap *living = GetLivingMapping();
 
-  return *tracer.release();
+  void *record = living->Pool().Allocate();
+
+  try
+  {
+    return *new (record) ObjectTracer(object, key, living);
+  }
+  catch (...)
+  {
+    living->Pool().Release(record);
+
+    throw;
+  }
+}
+
+ObjectTracer& ObjectTracer::Trace(v8::Handle<v8::Value> handle, py::object object)
+{
+  ObjectTracer& tracer = Allocate(object);
+
+  tracer.Trace(handle);
+
+  return tracer;
 }
 
-void ObjectTracer::Trace(void)
+void ObjectTracer::Trace(v8::Handle<v8::Value> handle)
 {
+  m_handle.Reset(v8::Isolate::GetCurrent(), handle);
   m_handle.SetWeak(this, WeakCallback);
 
-  m_living->insert(std::make_pair(m_object->ptr(), this));
+  m_living->Insert(m_key, this);
 }
 
 void ObjectTracer::WeakCallback(const v8::WeakCallbackData<v8::Value, ObjectTracer>& data)
 {
-  std::auto_ptr<ObjectTracer> tracer(data.GetParameter());
+  ObjectTracer *tracer = data.GetParameter();
 
   assert(data.GetValue() == tracer->m_handle);
+
+  tracer->Release();
 }
 
 LivingMap * ObjectTracer::GetLivingMapping(void)
 {
   v8::HandleScope handle_scope(v8::Isolate::GetCurrent());
 
-  v8::Handle<v8::Context> ctxt = v8::Isolate::GetCurrent()->GetCurrentContext();
+  return GetLivingMapping(v8::Isolate::GetCurrent()->GetCurrentContext(), true);
+}
 
-  v8::Handle<v8::Value> value = ctxt->Global()->GetHiddenValue(v8::String::NewFromUtf8(v8::Isolate::GetCurrent(), "__living__"));
+LivingMap * ObjectTracer::GetLivingMapping(v8::Handle<v8::Context> ctxt, bool create)
+{
+  v8::Handle<v8::Value> value = ctxt->GetEmbedderData(kLivingMapSlot);
 
-  if (!value.IsEmpty())
+  if (!value.IsEmpty() && value->IsExternal())
   {
-    LivingMap *living = (LivingMap *) v8::External::Cast(*value)->Value();
-
-    if (living) return living;
+    return static_cast<LivingMap *>(v8::Handle<v8::External>::Cast(value)->Value());
   }
 
+  if (!create) return NULL;
+
   std::auto_ptr<LivingMap> living(new LivingMap());
 
-  ctxt->Global()->SetHiddenValue(v8::String::NewFromUtf8(v8::Isolate::GetCurrent(), "__living__"), v8::External::New(v8::Isolate::GetCurrent(), living.get()));
+  ctxt->SetEmbedderData(kLivingMapSlot, v8::External::New(ctxt->GetIsolate(), living.get()));
 
   ContextTracer::Trace(ctxt, living.get());
 
@@ -1940,17 +4813,200 @@ v8::Handle<v8::Value> ObjectTracer::FindCache(py::object obj)
 
   if (living)
   {
-    LivingMap::const_iterator it = living->find(obj.ptr());
+    ObjectTracer *tracer = living->Find(obj.ptr());
 
-    if (it != living->end())
+    if (tracer)
     {
-      return v8::Local<v8::Value>::New(v8::Isolate::GetCurrent(), it->second->m_handle);
+      return v8::Local<v8::Value>::New(v8::Isolate::GetCurrent(), tracer->m_handle);
     }
   }
 
   return v8::Handle<v8::Value>();
 }
 
+LivingMap::LivingMap(void)
+  : m_slots(NULL), m_capacity(0), m_size(0), m_used(0),
+    m_pool(sizeof(ObjectTracer)), m_tracers(NULL)
+{
+  Rehash(16);
+}
+
+LivingMap::~LivingMap(void)
+{
+  assert(!m_tracers);
+
+  delete [] m_slots;
+}
+
+// the tombstone of a deleted slot, which never be a valid object address
+#define LIVING_MAP_DELETED_KEY reinterpret_cast<PyObject *>(1)
+
+size_t LivingMap::Probe(PyObject *key) const
+{
+  size_t hash = reinterpret_cast<size_t>(key) >> 3;
+
+  hash ^= hash >> 16;
+  hash *= 0x45d9f3b;
+  hash ^= hash >> 16;
+
+  return hash & (m_capacity - 1);
+}
+
+void LivingMap::Rehash(size_t capacity)
+{
+  Slot *slots = m_slots;
+  size_t old_capacity = m_capacity;
+
+  m_slots = new Slot[capacity];
+  m_capacity = capacity;
+  m_size = m_used = 0;
+
+  memset(m_slots, 0, sizeof(Slot) * capacity);
+
+  for (size_t i=0; i<old_capacity; i++)
+  {
+    if (slots[i].key && slots[i].key != LIVING_MAP_DELETED_KEY)
+    {
+      Insert(slots[i].key, slots[i].tracer);
+    }
+  }
+
+  delete [] slots;
+}
+
+ObjectTracer *LivingMap::Find(PyObject *key) const
+{
+  for (size_t idx = Probe(key); m_slots[idx].key; idx = (idx + 1) & (m_capacity - 1))
+  {
+    if (m_slots[idx].key == key) return m_slots[idx].tracer;
+  }
+
+  return NULL;
+}
+
+bool LivingMap::Insert(PyObject *key, ObjectTracer *tracer)
+{
+  // keep the load factor under 3/4, and drop the tombstones if most slots are deleted
+  if ((m_used + 1) * 4 > m_capacity * 3)
+  {
+    Rehash(m_size * 2 >= m_capacity / 2 ? m_capacity * 2 : m_capacity);
+  }
+
+  size_t free_idx = m_capacity;
+
+  for (size_t idx = Probe(key); ; idx = (idx + 1) & (m_capacity - 1))
+  {
+    if (!m_slots[idx].key)
+    {
+      if (free_idx == m_capacity)
+      {
+        free_idx = idx;
+        m_used++;
+      }
+
+      break;
+    }
+
+    if (m_slots[idx].key == key) return false;
+
+    if (m_slots[idx].key == LIVING_MAP_DELETED_KEY && free_idx == m_capacity) free_idx = idx;
+  }
+
+  m_slots[free_idx].key = key;
+  m_slots[free_idx].tracer = tracer;
+  m_size++;
+
+  return true;
+}
+
+void LivingMap::Erase(PyObject *key, ObjectTracer *tracer)
+{
+  for (size_t idx = Probe(key); m_slots[idx].key; idx = (idx + 1) & (m_capacity - 1))
+  {
+    if (m_slots[idx].key == key)
+    {
+      if (m_slots[idx].tracer == tracer)
+      {
+        m_slots[idx].key = LIVING_MAP_DELETED_KEY;
+        m_slots[idx].tracer = NULL;
+        m_size--;
+      }
+
+      return;
+    }
+  }
+}
+
+void LivingMap::Link(ObjectTracer *tracer)
+{
+  tracer->m_prev = NULL;
+  tracer->m_next = m_tracers;
+
+  if (m_tracers) m_tracers->m_prev = tracer;
+
+  m_tracers = tracer;
+}
+
+void LivingMap::Unlink(ObjectTracer *tracer)
+{
+  if (tracer->m_prev)
+    tracer->m_prev->m_next = tracer->m_next;
+  else
+    m_tracers = tracer->m_next;
+
+  if (tracer->m_next) tracer->m_next->m_prev = tracer->m_prev;
+
+  tracer->m_prev = tracer->m_next = NULL;
+}
+
+SlabPool::SlabPool(size_t recordSize, size_t slabRecords)
+  : m_recordSize(std::max(recordSize, sizeof(FreeRecord))), m_slabRecords(slabRecords),
+    m_used(slabRecords), m_free(NULL)
+{
+  // keep the records aligned to the pointer size
+  m_recordSize = (m_recordSize + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+}
+
+SlabPool::~SlabPool(void)
+{
+  for (std::vector<char *>::iterator it = m_slabs.begin(); it != m_slabs.end(); it++)
+  {
+    ::free(*it);
+  }
+}
+
+void *SlabPool::Allocate(void)
+{
+  if (m_free)
+  {
+    FreeRecord *record = m_free;
+
+    m_free = record->next;
+
+    return record;
+  }
+
+  if (m_used == m_slabRecords)
+  {
+    char *slab = static_cast<char *>(::malloc(m_recordSize * m_slabRecords));
+
+    if (!slab) throw std::bad_alloc();
+
+    m_slabs.push_back(slab);
+    m_used = 0;
+  }
+
+  return m_slabs.back() + m_recordSize * m_used++;
+}
+
+void SlabPool::Release(void *record)
+{
+  FreeRecord *free_record = static_cast<FreeRecord *>(record);
+
+  free_record->next = m_free;
+  m_free = free_record;
+}
+
 ContextTracer::ContextTracer(v8::Handle<v8::Context> ctxt, LivingMap *living)
   : m_ctxt(v8::Isolate::GetCurrent(), ctxt), m_living(living)
 {
@@ -1958,13 +5014,13 @@ ContextTracer::ContextTracer(v8::Handle<v8::Context> ctxt, LivingMap *living)
 
 ContextTracer::~ContextTracer(void)
 {
-  Context()->Global()->DeleteHiddenValue(v8::String::NewFromUtf8(v8::Isolate::GetCurrent(), "__living__"));
+  CPythonGIL python_gil;
 
-  for (LivingMap::const_iterator it = m_living->begin(); it != m_living->end(); it++)
+  // destroy the living tracers, their records will be freed in bulk with the pool
+  while (ObjectTracer *tracer = m_living->First())
   {
-    std::auto_ptr<ObjectTracer> tracer(it->second);
-
     tracer->Dispose();
+    tracer->~ObjectTracer();
   }
 }
 
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <map>
+#include <set>
+#include <list>
+#include <vector>
 #include <sstream>
 
 #include <boost/shared_ptr.hpp>
@@ -10,12 +13,19 @@
 
 class CJavascriptObject;
 class CJavascriptFunction;
+class CJavascriptCallSite;
+class CJavascriptArrayBuffer;
+class CJavascriptTypedArray;
+class ExternalBuffer;
 class CIsolate;
 
 typedef boost::shared_ptr<CIsolate> CIsolatePtr;
 
 typedef boost::shared_ptr<CJavascriptObject> CJavascriptObjectPtr;
 typedef boost::shared_ptr<CJavascriptFunction> CJavascriptFunctionPtr;
+typedef boost::shared_ptr<CJavascriptCallSite> CJavascriptCallSitePtr;
+typedef boost::shared_ptr<CJavascriptArrayBuffer> CJavascriptArrayBufferPtr;
+typedef boost::shared_ptr<CJavascriptTypedArray> CJavascriptTypedArrayPtr;
 
 struct CWrapper
 {
@@ -24,6 +34,12 @@ struct CWrapper
 
 class CPythonObject : public CWrapper
 {
+public:
+#ifdef SUPPORT_TYPE_TEMPLATE
+  // the attribute names declared by a type template
+  typedef std::set<std::string> AttrNames;
+#endif
+private:
   static void NamedGetter(v8::Local<v8::String> prop, const v8::PropertyCallbackInfo<v8::Value>& info);
   static void NamedSetter(v8::Local<v8::String> prop, v8::Local<v8::Value> value, const v8::PropertyCallbackInfo<v8::Value>& info);
   static void NamedQuery(v8::Local<v8::String> prop, const v8::PropertyCallbackInfo<v8::Integer>& info);
@@ -38,23 +54,86 @@ class CPythonObject : public CWrapper
 
   static void Caller(const v8::FunctionCallbackInfo<v8::Value>& info);
 
+  // the arguments up to this count will be passed on the stack if vectorcall is supported
+  static const int kMaxStackArgs = 8;
+
+  static py::object Call(py::object callable, const v8::FunctionCallbackInfo<v8::Value>& info);
+
+#ifdef SUPPORT_TYPE_TEMPLATE
+  static void AttrGetter(v8::Local<v8::String> prop, const v8::PropertyCallbackInfo<v8::Value>& info);
+  static void AttrSetter(v8::Local<v8::String> prop, v8::Local<v8::Value> value, const v8::PropertyCallbackInfo<void>& info);
+  static void MethodCaller(const v8::FunctionCallbackInfo<v8::Value>& info);
+
+  friend class TypeTemplateCache;
+#endif
+
+  friend class FunctionTemplateCache;
+
 #ifdef SUPPORT_TRACE_LIFECYCLE
   static void DisposeCallback(v8::Persistent<v8::Value> object, void* parameter);
 #endif
 protected:
   static void SetupObjectTemplate(v8::Isolate *isolate, v8::Handle<v8::ObjectTemplate> clazz);
   static v8::Handle<v8::ObjectTemplate> CreateObjectTemplate(v8::Isolate *isolate);
+#ifdef SUPPORT_TYPE_TEMPLATE
+  static v8::Handle<v8::ObjectTemplate> CreateTypeTemplate(v8::Isolate *isolate, py::object type, py::list names, AttrNames& declared);
+#endif
 
   static v8::Handle<v8::Value> WrapInternal(py::object obj, v8::Isolate* isolate);
 public:
   static bool IsWrapped(v8::Handle<v8::Object> obj);
   static v8::Handle<v8::Value> Wrap(py::object obj, v8::Isolate* isolate);
+  // copy the nested dicts, lists and tuples to the native Javascript objects and arrays
+  static v8::Handle<v8::Value> Copy(py::object obj, v8::Isolate* isolate);
   static py::object Unwrap(v8::Handle<v8::Object> obj, v8::Isolate* isolate);
   static void Dispose(v8::Handle<v8::Value> value, v8::Isolate* isolate);
 
   static void ThrowIf(v8::Isolate* isolate);
 };
 
+//
+// The conversion plan of a Python function declared with JSSignature,
+// which is built once when the function is wrapped and replaces its payload.
+//
+class CallPlan
+{
+public:
+  enum Kind
+  {
+    kObject,
+    kInt32,
+    kUInt32,
+    kDouble,
+    kBool,
+    kStr,
+    kBytes
+  };
+private:
+  py::object m_callable;
+  std::vector<Kind> m_argtypes;
+  Kind m_restype;
+  bool m_keywords;
+
+  static void Destructor(PyObject *capsule);
+public:
+  CallPlan(py::object callable, py::object signature);
+
+  v8::Handle<v8::Value> Invoke(const v8::FunctionCallbackInfo<v8::Value>& info) const;
+
+  static Kind ParseKind(py::object spec);
+
+  // return a new reference of the converted value, or NULL if failed
+  static PyObject *ToPython(Kind kind, v8::Handle<v8::Value> value, v8::Isolate *isolate);
+  static v8::Handle<v8::Value> ToJavascript(Kind kind, py::object value, v8::Isolate *isolate);
+
+  // coerce the value like ToNumber of Javascript, so the numeric types convert the same in both directions
+  static double ToNumber(py::object value, v8::Isolate *isolate);
+
+  // return the callable itself if it isn't declared with a signature
+  static py::object CreatePayload(py::object callable);
+  static const CallPlan *FromPayload(py::object payload);
+};
+
 struct ILazyObject
 {
   virtual void LazyConstructor(void) = 0;
@@ -93,16 +172,23 @@ public:
 
   v8::Local<v8::Object> Object(void) const { return v8::Local<v8::Object>::New(m_isolate, m_obj); }
 
-  py::object GetAttr(const std::string& name);
-  void SetAttr(const std::string& name, py::object value);
-  void DelAttr(const std::string& name);
+  py::object GetAttr(py::object name);
+  void SetAttr(py::object name, py::object value);
+  void DelAttr(py::object name);
 
   py::list GetAttrList(void);
+  py::list GetValueList(void);
+  py::list GetItemList(void);
+  py::dict ToDict(void);
+  void Update(py::object mapping);
+
+  // convert to Python lists and dicts recursively, the depth is unlimited if it is negative
+  py::object ToPython(int depth, const std::string& cycles);
 
   int GetIdentityHash(void);
   CJavascriptObjectPtr Clone(void);
 
-  bool Contains(const std::string& name);
+  bool Contains(py::object name);
 
   operator long() const;
   operator double() const;
@@ -146,14 +232,27 @@ class CJavascriptArray : public CJavascriptObject, public ILazyObject
   size_t m_size;
   
 public:
+  //
+  // Iterate the items in chunks, each chunk is converted under a single handle scope,
+  // so the later changes of array may not be visible until the next chunk.
+  //
   class ArrayIterator
     : public boost::iterator_facade<ArrayIterator, py::object const, boost::forward_traversal_tag, py::object>
   {
+    struct Chunk
+    {
+      size_t base;
+      std::vector<py::object> items;
+    };
+
     CJavascriptArray *m_array;
-    size_t m_idx;
+    size_t m_idx, m_end;
+    mutable boost::shared_ptr<Chunk> m_chunk;
   public:
-    ArrayIterator(CJavascriptArray *array, size_t idx)
-      : m_array(array), m_idx(idx)
+    static const size_t kChunkSize = 256;
+
+    ArrayIterator(CJavascriptArray *array, size_t idx, size_t end)
+      : m_array(array), m_idx(idx), m_end(end)
     {
     }
 
@@ -161,7 +260,18 @@ public:
 
     bool equal(ArrayIterator const& other) const { return m_array == other.m_array && m_idx == other.m_idx; }
 
-    reference dereference() const { return m_array->GetItem(py::long_(m_idx)); }
+    reference dereference() const
+    {
+      if (!m_chunk || m_idx < m_chunk->base || m_idx >= m_chunk->base + m_chunk->items.size())
+      {
+        if (!m_chunk) m_chunk.reset(new Chunk());
+
+        m_chunk->base = m_idx;
+        m_array->GetItems(m_idx, std::min(kChunkSize, m_end - m_idx), m_chunk->items);
+      }
+
+      return m_chunk->items[m_idx - m_chunk->base];
+    }
   };
 
   CJavascriptArray(v8::Isolate* isolate, v8::Handle<v8::Array> array);
@@ -175,18 +285,92 @@ public:
   py::object DelItem(py::object key);
   bool Contains(py::object item);
 
-  ArrayIterator begin(void) { return ArrayIterator(this, 0);}
-  ArrayIterator end(void) { return ArrayIterator(this, Length());}
+  // convert the items in [start, start+count), the missing items are converted to None
+  void GetItems(size_t start, size_t count, std::vector<py::object>& items);
+
+  ArrayIterator begin(void) { return ArrayIterator(this, 0, Length());}
+  ArrayIterator end(void) { size_t length = Length(); return ArrayIterator(this, length, length);}
 
   // ILazyObject
   virtual void LazyConstructor(void);
 };
 
+//
+// The binary data of Javascript, which exposes the backing store of ArrayBuffer
+// to Python with the buffer protocol, the memoryview keeps the wrapper alive,
+// and the wrapper keeps the ArrayBuffer alive, so the data will never be copied.
+//
+class CJavascriptArrayBuffer : public CJavascriptObject
+{
+protected:
+  char *m_data;
+  Py_ssize_t m_length;
+  Py_ssize_t m_itemsize;
+  Py_ssize_t m_shape;
+  const char *m_format;
+
+  CJavascriptArrayBuffer(v8::Isolate* isolate, v8::Handle<v8::Object> obj)
+    : CJavascriptObject(isolate, obj), m_data(NULL), m_length(0), m_itemsize(1), m_shape(0), m_format("B")
+  {
+  }
+
+  // read the memory range of buffer, which is emptied when the buffer is neutered
+  bool ReadContents(v8::Handle<v8::ArrayBuffer> buffer, size_t offset, size_t length);
+
+  // re-read the memory and length from the V8 object, return false if the buffer was neutered
+  virtual bool Update(void);
+
+  // create an externalized ArrayBuffer over the memory of Python buffer, or over a copy of the read-only one
+  static v8::Handle<v8::ArrayBuffer> NewExternal(v8::Isolate* isolate, std::auto_ptr<ExternalBuffer> external);
+
+  static int GetBuffer(PyObject *exporter, Py_buffer *view, int flags);
+#if PY_MAJOR_VERSION < 3
+  static Py_ssize_t GetReadBuffer(PyObject *exporter, Py_ssize_t segment, void **ptr);
+  static Py_ssize_t GetWriteBuffer(PyObject *exporter, Py_ssize_t segment, void **ptr);
+  static Py_ssize_t GetSegCount(PyObject *exporter, Py_ssize_t *len);
+  static Py_ssize_t GetCharBuffer(PyObject *exporter, Py_ssize_t segment, char **ptr);
+#endif
+public:
+  CJavascriptArrayBuffer(v8::Isolate* isolate, v8::Handle<v8::ArrayBuffer> buffer);
+
+  Py_ssize_t GetByteLength(void) { Update(); return m_length; }
+
+  static CJavascriptArrayBufferPtr Create(py::object obj);
+
+  // release the Python buffers still exported to the isolate
+  static void Dispose(v8::Isolate *isolate);
+
+  // install the buffer protocol to the exposed Python class
+  static void SetupBufferProcs(py::object cls);
+};
+
+class CJavascriptTypedArray : public CJavascriptArrayBuffer
+{
+  Py_ssize_t m_offset;
+protected:
+  virtual bool Update(void);
+public:
+  CJavascriptTypedArray(v8::Isolate* isolate, v8::Handle<v8::ArrayBufferView> view);
+
+  Py_ssize_t GetByteOffset(void) { Update(); return m_offset; }
+  Py_ssize_t Length(void) { Update(); return m_shape; }
+  const std::string GetFormat(void) const { return m_format; }
+
+  py::object GetArrayBuffer(void);
+
+  static CJavascriptTypedArrayPtr Create(py::object obj, py::object format);
+};
+
 class CJavascriptFunction : public CJavascriptObject
 {
   v8::Persistent<v8::Object> m_self;
 
   py::object Call(v8::Handle<v8::Object> self, py::list args, py::dict kwds);
+
+  // resolve the receiver from a Python object, the owner of function will be used for None
+  v8::Handle<v8::Object> GetReceiver(py::object self) const;
+
+  py::object Batch(py::object iterable, py::object self, bool star, size_t chunk_size, py::object out);
 public:
   CJavascriptFunction(v8::Isolate* isolate, v8::Handle<v8::Object> self, v8::Handle<v8::Function> func)
     : CJavascriptObject(isolate, func), m_self(v8::Isolate::GetCurrent(), self)
@@ -207,6 +391,11 @@ public:
   py::object ApplyPython(py::object self, py::list args, py::dict kwds);
   py::object Invoke(py::list args, py::dict kwds);
 
+  CJavascriptCallSitePtr Prepare(py::object argtypes, py::object self, py::object restype, bool release_gil);
+
+  py::object Map(py::object iterable, py::object self, size_t chunk_size, py::object out) { return Batch(iterable, self, false, chunk_size, out); }
+  py::object StarMap(py::object iterable, py::object self, size_t chunk_size, py::object out) { return Batch(iterable, self, true, chunk_size, out); }
+
   const std::string GetName(void) const;
   void SetName(const std::string& name);
 
@@ -220,34 +409,367 @@ public:
   py::object GetOwner(void) const;
 };
 
+//
+// The prepared call site of a Javascript function, which keeps the receiver and
+// the converters of arguments, so the repeated calls only convert and invoke.
+//
+class CJavascriptCallSite
+{
+  v8::Isolate *m_isolate;
+  v8::Persistent<v8::Function> m_func;
+  v8::Persistent<v8::Object> m_self;
+
+  std::vector<CallPlan::Kind> m_argtypes;
+  CallPlan::Kind m_restype;
+  bool m_releaseGIL;
+
+  // the arguments up to this count will be passed on the stack
+  static const size_t kMaxStackArgs = 8;
+
+  py::object Call(py::tuple args, size_t offset);
+public:
+  CJavascriptCallSite(v8::Isolate *isolate, v8::Handle<v8::Function> func, v8::Handle<v8::Object> self,
+                      py::object argtypes, py::object restype, bool release_gil);
+  ~CJavascriptCallSite()
+  {
+    m_func.Reset();
+    m_self.Reset();
+  }
+
+  static py::object CallWithArgs(py::tuple args, py::dict kwds);
+};
+
+//
+// The embedder data slots of context used by PyV8, the index 0 is reserved for the debugger
+//
+enum ContextDataSlot
+{
+  kWrapperCacheSlot = 1,
+  kLivingMapSlot = 2
+};
+
+//
+// The data slots of isolate used by PyV8
+//
+enum IsolateDataSlot
+{
+  kTypeTemplateSlot = 0,
+  kFunctionTemplateSlot = 1,
+  kPropertyNameSlot = 2,
+  kConvertHookSlot = 3
+};
+
+//
+// Cache the internalized property names of the interned Python attribute names in the isolate,
+// so the repeated attribute access doesn't need to transcode and internalize the name again.
+//
+// The names are looked up by identity, and the least recently used ones will be evicted.
+//
+class PropertyNameCache
+{
+  struct Entry
+  {
+    py::object name;
+    v8::Persistent<v8::String> value;
+  };
+
+  typedef std::list<Entry *> EntryList;
+  typedef std::map<PyObject *, EntryList::iterator> EntryMap;
+
+  EntryList m_lru;
+  EntryMap m_entries;
+public:
+  static const size_t kMaxEntries = 1024;
+
+  ~PropertyNameCache(void);
+
+  size_t Size(void) const { return m_entries.size(); }
+
+  v8::Handle<v8::String> Get(v8::Isolate *isolate, py::object name);
+
+  static PropertyNameCache *GetCache(v8::Isolate *isolate, bool create);
+  static void Dispose(v8::Isolate *isolate);
+
+  // convert the Python attribute name, only the interned names will be cached
+  static v8::Handle<v8::String> ToPropertyName(v8::Isolate *isolate, py::object name);
+};
+
+//
+// Cache the FunctionTemplate of the stable Python callables in the isolate,
+// such as the types, builtin functions and module level functions.
+//
+// The function instantiated from a template is kept by each context, which holds the callable through the template data.
+// The cache only refers to the callables and templates weakly, so they are released with the contexts,
+// and the least recently used entries will be evicted.
+//
+class FunctionTemplateCache
+{
+  struct Entry
+  {
+    PyObject *callable;   // the address of the callable, as the key of the map
+    py::object key;   // weak reference to the callable, or the callable itself if it can't be weakly referenced
+    v8::Persistent<v8::FunctionTemplate> tmpl;
+  };
+
+  typedef std::list<Entry *> EntryList;
+  typedef std::map<PyObject *, EntryList::iterator> EntryMap;
+
+  class Payload;
+
+  EntryList m_lru;
+  EntryMap m_entries;
+  std::set<Payload *> m_payloads;   // the template data alive, released when the isolate is disposed
+
+  void Evict(EntryMap::iterator it);
+
+  static bool IsStable(py::object callable);
+  static void WeakCallback(const v8::WeakCallbackData<v8::FunctionTemplate, Entry>& data);
+public:
+  static const size_t kMaxEntries = 4096;
+
+  ~FunctionTemplateCache(void);
+
+  size_t Size(void) const { return m_entries.size(); }
+
+  // return an empty handle if the callable should not be cached
+  v8::Handle<v8::FunctionTemplate> Get(v8::Isolate *isolate, py::object callable);
+
+  static FunctionTemplateCache *GetCache(v8::Isolate *isolate, bool create);
+  static void Dispose(v8::Isolate *isolate);
+};
+
+//
+// The C converter of a Python type, exported as a capsule named "PyV8.__js__" in its __js__ attribute,
+// it returns a new reference to the Python value used as the Javascript representation, or NULL on error.
+//
+typedef PyObject *(*JSConverter)(PyObject *obj);
+
+#define JS_CONVERTER_CAPSULE "PyV8.__js__"
+
+//
+// Cache the __js__ conversion hook of each Python type in the isolate,
+// the hook is either a method returning the Javascript representation or a capsule of JSConverter,
+// the types without a hook are cached as well.
+//
+// The hook is looked up again after the type is modified, and the least recently used types will be evicted.
+//
+class ConvertHookCache
+{
+  struct Entry
+  {
+    py::object type;
+    unsigned int version;   // the version tag of type when the hook was looked up
+    py::object method;
+    JSConverter converter;
+  };
+
+  typedef std::list<Entry *> EntryList;
+  typedef std::map<PyTypeObject *, EntryList::iterator> EntryMap;
+
+  EntryList m_lru;
+  EntryMap m_entries;
+
+  static void Lookup(Entry *entry);
+public:
+  static const size_t kMaxEntries = 1024;
+
+  ~ConvertHookCache(void);
+
+  size_t Size(void) const { return m_entries.size(); }
+
+  // return false if the type of object has no hook
+  bool Convert(py::object obj, py::object& result);
+
+  static ConvertHookCache *GetCache(v8::Isolate *isolate, bool create);
+  static void Dispose(v8::Isolate *isolate);
+};
+
+#ifdef SUPPORT_TYPE_TEMPLATE
+
+//
+// Cache the ObjectTemplate of each Python type in the isolate,
+// the marked types are kept since their templates are referred by the instances,
+// and only the recently used types without the __jstemplate__ mark are remembered.
+//
+class TypeTemplateCache
+{
+  struct Entry
+  {
+    py::object type;
+    py::list names;   // the declared attribute names, referred by the accessors
+    CPythonObject::AttrNames declared;  // the same names, skipped by the interceptors
+    v8::Persistent<v8::ObjectTemplate> tmpl;
+  };
+
+  typedef std::map<PyTypeObject *, Entry *> EntryMap;
+  typedef std::list<py::object> TypeList;
+  typedef std::map<PyTypeObject *, TypeList::iterator> TypeMap;
+
+  EntryMap m_entries;
+  TypeList m_lru;
+  TypeMap m_unmarked;
+public:
+  static const size_t kMaxUnmarked = 1024;
+
+  ~TypeTemplateCache(void);
+
+  size_t Size(void) const { return m_entries.size() + m_unmarked.size(); }
+
+  v8::Handle<v8::ObjectTemplate> Get(v8::Isolate *isolate, py::object obj);
+
+  static TypeTemplateCache *GetCache(v8::Isolate *isolate, bool create);
+  static void Dispose(v8::Isolate *isolate);
+};
+
+#endif
+
+#ifdef SUPPORT_WRAPPER_CACHE
+
+//
+// Keep a weak reference to the Python wrapper of each Javascript object,
+// so the same object will be wrapped only once in the same context.
+//
+class WrapperCache
+{
+  struct Entry
+  {
+    PyObject *ref;            // weak reference to the Python wrapper
+    CJavascriptObject *obj;   // only valid when the wrapper is alive
+  };
+
+  typedef std::multimap<int, Entry> EntryMap;
+
+  v8::Persistent<v8::Context> m_ctxt;
+  EntryMap m_entries;
+  size_t m_sweepSize;
+
+  void Sweep(void);
+
+  static void WeakCallback(const v8::WeakCallbackData<v8::Context, WrapperCache>& data);
+public:
+  WrapperCache(v8::Handle<v8::Context> ctxt);
+  ~WrapperCache(void);
+
+  size_t Size(void) const { return m_entries.size(); }
+
+  py::object Find(int hash, v8::Handle<v8::Object> obj, v8::Handle<v8::Object> self);
+  void Insert(int hash, py::object wrapper, CJavascriptObject *obj);
+
+  static WrapperCache *GetCache(v8::Isolate *isolate);
+};
+
+#endif
+
 #ifdef SUPPORT_TRACE_LIFECYCLE
 
 class ObjectTracer;
 
-typedef std::map<PyObject *, ObjectTracer *> LivingMap;
+//
+// Allocate the fixed size records from the large slabs,
+// the released records are reused and all the slabs are freed in bulk with the pool.
+//
+class SlabPool
+{
+  struct FreeRecord
+  {
+    FreeRecord *next;
+  };
+
+  size_t m_recordSize;
+  size_t m_slabRecords;
+  std::vector<char *> m_slabs;
+  size_t m_used;        // the allocated records in the last slab
+  FreeRecord *m_free;   // the released records
+
+  SlabPool(const SlabPool&);
+  SlabPool& operator=(const SlabPool&);
+public:
+  SlabPool(size_t recordSize, size_t slabRecords = 256);
+  ~SlabPool(void);
+
+  size_t MemoryUsage(void) const { return m_slabs.size() * m_slabRecords * m_recordSize; }
+
+  void *Allocate(void);
+  void Release(void *record);
+};
+
+//
+// Open addressing hash table from the living Python objects to their tracers,
+// the lookup is allocation-free and probes the slots linearly.
+//
+// The tracers of a context are allocated from its pool and linked together,
+// so they could be destroyed at once when the context is disposed.
+//
+class LivingMap
+{
+  struct Slot
+  {
+    PyObject *key;
+    ObjectTracer *tracer;
+  };
+
+  Slot *m_slots;
+  size_t m_capacity;  // always a power of 2
+  size_t m_size;      // the living entries
+  size_t m_used;      // the living and deleted entries
+
+  SlabPool m_pool;
+  ObjectTracer *m_tracers;
+
+  size_t Probe(PyObject *key) const;
+  void Rehash(size_t capacity);
+public:
+  LivingMap(void);
+  ~LivingMap(void);
+
+  size_t Size(void) const { return m_size; }
+  size_t Capacity(void) const { return m_capacity; }
+  size_t MemoryUsage(void) const { return sizeof(LivingMap) + m_capacity * sizeof(Slot) + m_pool.MemoryUsage(); }
+
+  ObjectTracer *Find(PyObject *key) const;
+  bool Insert(PyObject *key, ObjectTracer *tracer);
+  void Erase(PyObject *key, ObjectTracer *tracer);
+
+  SlabPool& Pool(void) { return m_pool; }
+
+  void Link(ObjectTracer *tracer);
+  void Unlink(ObjectTracer *tracer);
+
+  ObjectTracer *First(void) const { return m_tracers; }
+};
 
 class ObjectTracer
 {
   v8::Persistent<v8::Value> m_handle;
-  std::auto_ptr<py::object> m_object;
+  py::object m_object;
+  PyObject *m_key;    // the object itself, or the callable kept alive by its call plan
 
   LivingMap *m_living;
+  ObjectTracer *m_prev, *m_next;
 
-  void Trace(void);
+  ObjectTracer(py::object object, PyObject *key, LivingMap *living);
+  ~ObjectTracer(void);
 
   static void WeakCallback(const v8::WeakCallbackData<v8::Value, ObjectTracer>& data);
 
   static LivingMap *GetLivingMapping(void);
+
+  friend class LivingMap;
+  friend class ContextTracer;
 public:
-  ObjectTracer(v8::Handle<v8::Value> handle, py::object *object);
-  ~ObjectTracer(void);
+  static LivingMap *GetLivingMapping(v8::Handle<v8::Context> ctxt, bool create);
 
   const v8::Persistent<v8::Value>& Handle(void) const { return m_handle; }
-  py::object *Object(void) const { return m_object.get(); }
+  py::object *Object(void) { return &m_object; }
 
+  void Trace(v8::Handle<v8::Value> handle);
   void Dispose(void);
+  void Release(void);
 
-  static ObjectTracer& Trace(v8::Handle<v8::Value> handle, py::object *object);
+  // allocate a tracer in the current context, which should be traced or released later,
+  // it will be found by the key instead of the object if the key is given
+  static ObjectTracer& Allocate(py::object object, PyObject *key = NULL);
+  static ObjectTracer& Trace(v8::Handle<v8::Value> handle, py::object object);
 
   static v8::Handle<v8::Value> FindCache(py::object obj);
 };
@@ -0,0 +1,124 @@
+// Microbenchmark of the vectorized UTF-8 kernels against the utfcpp conversions
+//
+// It is not a part of the extension, build and run it standalone, for example
+//
+//   g++ -O2 -o utf8_benchmark src/utf8/benchmark.cpp && ./utf8_benchmark
+//   g++ -O2 -mavx2 -o utf8_benchmark src/utf8/benchmark.cpp && ./utf8_benchmark
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+
+#include "checked.h"
+#include "simd.h"
+
+static double now()
+{
+    return static_cast<double>(clock()) / CLOCKS_PER_SEC;
+}
+
+// Build a text with the given ratio of non-ASCII characters, mixed of 2, 3 and 4 bytes sequences
+static std::string make_text(size_t size, int non_ascii_percent)
+{
+    static const char* samples[] = { "\xc3\xa9", "\xe4\xba\xba", "\xf0\x9f\x98\x83" };
+
+    std::string text;
+    unsigned int seed = 42;
+
+    while (text.size() < size) {
+        seed = seed * 1103515245 + 12345;
+
+        if (static_cast<int>((seed >> 16) % 100) < non_ascii_percent)
+            text += samples[(seed >> 8) % 3];
+        else
+            text += static_cast<char>('a' + (seed >> 8) % 26);
+    }
+
+    return text;
+}
+
+static void bench(const char* name, const std::string& text, int rounds)
+{
+    std::vector<utf8::uint16_t> expected, units(text.size());
+    utf8::utf8to16(text.begin(), text.end(), std::back_inserter(expected));
+
+    size_t len = utf8::simd::utf8_to_utf16(text.c_str(), text.size(), &units[0]);
+
+    if (len != expected.size() || !std::equal(expected.begin(), expected.end(), units.begin())) {
+        printf("%s: utf8_to_utf16 mismatch\n", name);
+        exit(1);
+    }
+
+    std::string bytes(len * 3, 0);
+
+    if (utf8::simd::utf16_to_utf8(&units[0], len, &bytes[0]) != text.size() || bytes.compare(0, text.size(), text) != 0) {
+        printf("%s: utf16_to_utf8 mismatch\n", name);
+        exit(1);
+    }
+
+    double mb = static_cast<double>(text.size()) * rounds / (1024 * 1024);
+    double start;
+    size_t sink = 0;
+
+    start = now();
+    for (int i = 0; i < rounds; i++) {
+        std::vector<utf8::uint16_t> out;
+        utf8::utf8to16(text.begin(), text.end(), std::back_inserter(out));
+        sink += out.size();
+    }
+    double utfcpp_decode = now() - start;
+
+    start = now();
+    for (int i = 0; i < rounds; i++) {
+        std::vector<utf8::uint16_t> out(text.size());
+        sink += utf8::simd::utf8_to_utf16(text.c_str(), text.size(), &out[0]);
+    }
+    double simd_decode = now() - start;
+
+    start = now();
+    for (int i = 0; i < rounds; i++) {
+        std::vector<char> out;
+        utf8::utf16to8(expected.begin(), expected.end(), std::back_inserter(out));
+        sink += out.size();
+    }
+    double utfcpp_encode = now() - start;
+
+    start = now();
+    for (int i = 0; i < rounds; i++) {
+        std::vector<char> out(len * 3);
+        sink += utf8::simd::utf16_to_utf8(&units[0], len, &out[0]);
+    }
+    double simd_encode = now() - start;
+
+    start = now();
+    for (int i = 0; i < rounds; i++)
+        sink += utf8::simd::is_valid(text.c_str(), text.size());
+    double simd_validate = now() - start;
+
+    printf("%-12s decode %8.1f -> %8.1f MB/s   encode %8.1f -> %8.1f MB/s   validate %8.1f MB/s  (%lu)\n",
+           name, mb / utfcpp_decode, mb / simd_decode, mb / utfcpp_encode, mb / simd_encode,
+           mb / simd_validate, static_cast<unsigned long>(sink % 10));
+}
+
+int main()
+{
+#ifdef UTF8_SIMD_AVX2
+    printf("kernels: AVX2 + SSE2\n");
+#elif defined(UTF8_SIMD_SSE2)
+    printf("kernels: SSE2\n");
+#else
+    printf("kernels: scalar\n");
+#endif
+
+    bench("ascii", make_text(1 << 20, 0), 200);
+    bench("1% unicode", make_text(1 << 20, 1), 200);
+    bench("10% unicode", make_text(1 << 20, 10), 100);
+    bench("cjk", make_text(1 << 20, 100), 50);
+    bench("short names", make_text(24, 0), 1000000);
+
+    return 0;
+}
@@ -0,0 +1,307 @@
+// Vectorized UTF-8 kernels for the mostly-ASCII strings
+//
+// The ASCII runs are scanned and widened/narrowed 16 (SSE2) or 32 (AVX2) bytes at a time,
+// the multi-bytes sequences are decoded and validated one code point at a time.
+// The AVX2 kernels are only enabled when the compiler targets AVX2 (-mavx2 or /arch:AVX2).
+
+#ifndef UTF8_FOR_CPP_SIMD_H_2675DCD0_9480_4c0c_B92A_CC14C027B731
+#define UTF8_FOR_CPP_SIMD_H_2675DCD0_9480_4c0c_B92A_CC14C027B731
+
+#include <cstddef>
+#include <cstring>
+
+#include "core.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define UTF8_SIMD_SSE2 1
+    #include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+    #define UTF8_SIMD_AVX2 1
+    #include <immintrin.h>
+#endif
+
+namespace utf8
+{
+namespace simd
+{
+    // The result of the kernels for an invalid input
+    const size_t npos = static_cast<size_t>(-1);
+
+namespace internal
+{
+    // Decode a non-ASCII sequence, return its length or 0 if it is invalid,
+    // the overlong sequences, surrogates and the code points beyond U+10FFFF are rejected.
+    inline size_t decode(const uint8_t* s, size_t len, uint32_t& cp)
+    {
+        uint8_t lead = s[0];
+
+        if (lead < 0xc2)
+            return 0;
+
+        if (lead < 0xe0) {
+            if (len < 2 || (s[1] & 0xc0) != 0x80)
+                return 0;
+            cp = ((lead & 0x1fu) << 6) | (s[1] & 0x3fu);
+            return 2;
+        }
+
+        if (lead < 0xf0) {
+            if (len < 3 || (s[1] & 0xc0) != 0x80 || (s[2] & 0xc0) != 0x80)
+                return 0;
+            cp = ((lead & 0x0fu) << 12) | ((s[1] & 0x3fu) << 6) | (s[2] & 0x3fu);
+            if (cp < 0x800 || utf8::internal::is_surrogate(cp))
+                return 0;
+            return 3;
+        }
+
+        if (lead < 0xf5) {
+            if (len < 4 || (s[1] & 0xc0) != 0x80 || (s[2] & 0xc0) != 0x80 || (s[3] & 0xc0) != 0x80)
+                return 0;
+            cp = ((lead & 0x07u) << 18) | ((s[1] & 0x3fu) << 12) | ((s[2] & 0x3fu) << 6) | (s[3] & 0x3fu);
+            if (cp < 0x10000 || cp > utf8::internal::CODE_POINT_MAX)
+                return 0;
+            return 4;
+        }
+
+        return 0;
+    }
+
+    // Skip the ASCII bytes in the blocks, stop at the block containing a non-ASCII byte
+    inline size_t skip_ascii(const uint8_t* s, size_t i, size_t len)
+    {
+#ifdef UTF8_SIMD_AVX2
+        for (; i + 32 <= len; i += 32) {
+            if (_mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i))))
+                return i;
+        }
+#endif
+#ifdef UTF8_SIMD_SSE2
+        for (; i + 16 <= len; i += 16) {
+            if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i))))
+                return i;
+        }
+#else
+        for (; i + 8 <= len; i += 8) {
+            unsigned long long word;
+            memcpy(&word, s + i, sizeof(word));
+            if (word & 0x8080808080808080ULL)
+                return i;
+        }
+#endif
+        return i;
+    }
+} // namespace internal
+
+    // Return the length of the leading ASCII characters
+    inline size_t ascii_prefix(const char* str, size_t len)
+    {
+        const uint8_t* s = reinterpret_cast<const uint8_t*>(str);
+
+        size_t i = internal::skip_ascii(s, 0, len);
+
+        while (i < len && s[i] < 0x80)
+            i++;
+
+        return i;
+    }
+
+    inline bool is_ascii(const char* str, size_t len)
+    {
+        return ascii_prefix(str, len) == len;
+    }
+
+    inline bool is_valid(const char* str, size_t len)
+    {
+        const uint8_t* s = reinterpret_cast<const uint8_t*>(str);
+        size_t i = 0;
+
+        while (i < len) {
+            if (s[i] < 0x80) {
+                i = internal::skip_ascii(s, i, len);
+
+                while (i < len && s[i] < 0x80)
+                    i++;
+
+                if (i == len)
+                    break;
+            }
+
+            uint32_t cp;
+            size_t n = internal::decode(s + i, len - i, cp);
+
+            if (!n)
+                return false;
+
+            i += n;
+        }
+
+        return true;
+    }
+
+    // Transcode UTF-8 to UTF-16, the output must have room for len code units.
+    // Return the number of code units written, or npos if the input is invalid.
+    inline size_t utf8_to_utf16(const char* str, size_t len, uint16_t* out)
+    {
+        const uint8_t* s = reinterpret_cast<const uint8_t*>(str);
+        uint16_t* p = out;
+        size_t i = 0;
+
+        while (i < len) {
+            if (s[i] < 0x80) {
+#ifdef UTF8_SIMD_AVX2
+                for (; i + 32 <= len; i += 32, p += 32) {
+                    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+
+                    if (_mm256_movemask_epi8(v))
+                        break;
+
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+                }
+#endif
+#ifdef UTF8_SIMD_SSE2
+                const __m128i zero = _mm_setzero_si128();
+
+                for (; i + 16 <= len; i += 16, p += 16) {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+
+                    if (_mm_movemask_epi8(v))
+                        break;
+
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_unpacklo_epi8(v, zero));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 8), _mm_unpackhi_epi8(v, zero));
+                }
+#endif
+                while (i < len && s[i] < 0x80)
+                    *p++ = s[i++];
+
+                if (i == len)
+                    break;
+            }
+
+            uint32_t cp;
+            size_t n = internal::decode(s + i, len - i, cp);
+
+            if (!n)
+                return npos;
+
+            if (cp < 0x10000) {
+                *p++ = static_cast<uint16_t>(cp);
+            } else {
+                *p++ = static_cast<uint16_t>((cp >> 10) + utf8::internal::LEAD_OFFSET);
+                *p++ = static_cast<uint16_t>((cp & 0x3ff) + utf8::internal::TRAIL_SURROGATE_MIN);
+            }
+
+            i += n;
+        }
+
+        return p - out;
+    }
+
+    // Transcode UTF-16 to UTF-8, the output must have room for len * 3 bytes.
+    // Return the number of bytes written, or npos if there is an unpaired surrogate.
+    inline size_t utf16_to_utf8(const uint16_t* s, size_t len, char* out)
+    {
+        uint8_t* p = reinterpret_cast<uint8_t*>(out);
+        size_t i = 0;
+
+        while (i < len) {
+            if (s[i] < 0x80) {
+#ifdef UTF8_SIMD_AVX2
+                const __m256i mask256 = _mm256_set1_epi16(static_cast<short>(0xff80));
+
+                for (; i + 32 <= len; i += 32, p += 32) {
+                    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+                    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + 16));
+
+                    if (!_mm256_testz_si256(_mm256_or_si256(a, b), mask256))
+                        break;
+
+                    // packus works in the 128 bits lanes, so the quadwords need to be reordered
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8));
+                }
+#endif
+#ifdef UTF8_SIMD_SSE2
+                const __m128i zero = _mm_setzero_si128(), mask = _mm_set1_epi16(static_cast<short>(0xff80));
+
+                for (; i + 16 <= len; i += 16, p += 16) {
+                    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+                    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 8));
+
+                    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(_mm_or_si128(a, b), mask), zero)) != 0xffff)
+                        break;
+
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_packus_epi16(a, b));
+                }
+#endif
+                while (i < len && s[i] < 0x80)
+                    *p++ = static_cast<uint8_t>(s[i++]);
+
+                if (i == len)
+                    break;
+            }
+
+            uint32_t cp = s[i++];
+
+            if (cp < 0x800) {
+                *p++ = static_cast<uint8_t>((cp >> 6) | 0xc0);
+                *p++ = static_cast<uint8_t>((cp & 0x3f) | 0x80);
+            } else if (utf8::internal::is_surrogate(cp)) {
+                if (!utf8::internal::is_lead_surrogate(cp) || i == len || !utf8::internal::is_trail_surrogate(s[i]))
+                    return npos;
+
+                cp = (cp << 10) + s[i++] + utf8::internal::SURROGATE_OFFSET;
+
+                *p++ = static_cast<uint8_t>((cp >> 18) | 0xf0);
+                *p++ = static_cast<uint8_t>(((cp >> 12) & 0x3f) | 0x80);
+                *p++ = static_cast<uint8_t>(((cp >> 6) & 0x3f) | 0x80);
+                *p++ = static_cast<uint8_t>((cp & 0x3f) | 0x80);
+            } else {
+                *p++ = static_cast<uint8_t>((cp >> 12) | 0xe0);
+                *p++ = static_cast<uint8_t>(((cp >> 6) & 0x3f) | 0x80);
+                *p++ = static_cast<uint8_t>((cp & 0x3f) | 0x80);
+            }
+        }
+
+        return p - reinterpret_cast<uint8_t*>(out);
+    }
+
+    // Transcode UTF-32 to UTF-8, the output must have room for len * 4 bytes.
+    // Return the number of bytes written, or npos if there is an invalid code point.
+    inline size_t utf32_to_utf8(const uint32_t* s, size_t len, char* out)
+    {
+        uint8_t* p = reinterpret_cast<uint8_t*>(out);
+
+        for (size_t i = 0; i < len; i++) {
+            uint32_t cp = s[i];
+
+            if (cp < 0x80) {
+                *p++ = static_cast<uint8_t>(cp);
+            } else if (cp < 0x800) {
+                *p++ = static_cast<uint8_t>((cp >> 6) | 0xc0);
+                *p++ = static_cast<uint8_t>((cp & 0x3f) | 0x80);
+            } else if (cp < 0x10000) {
+                if (utf8::internal::is_surrogate(cp))
+                    return npos;
+
+                *p++ = static_cast<uint8_t>((cp >> 12) | 0xe0);
+                *p++ = static_cast<uint8_t>(((cp >> 6) & 0x3f) | 0x80);
+                *p++ = static_cast<uint8_t>((cp & 0x3f) | 0x80);
+            } else if (cp <= utf8::internal::CODE_POINT_MAX) {
+                *p++ = static_cast<uint8_t>((cp >> 18) | 0xf0);
+                *p++ = static_cast<uint8_t>(((cp >> 12) & 0x3f) | 0x80);
+                *p++ = static_cast<uint8_t>(((cp >> 6) & 0x3f) | 0x80);
+                *p++ = static_cast<uint8_t>((cp & 0x3f) | 0x80);
+            } else {
+                return npos;
+            }
+        }
+
+        return p - reinterpret_cast<uint8_t*>(out);
+    }
+} // namespace utf8::simd
+} // namespace utf8
+
+#endif // header guard